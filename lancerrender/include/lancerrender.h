@@ -48,10 +48,28 @@ typedef enum LRPRIMTYPE {
     LRPRIMTYPE_LINELIST
 } LRPRIMTYPE;
 
+/* How streamed buffers and uniform buffers reach the GPU */
+typedef enum LRBUFFERUPDATE {
+    LRBUFFERUPDATE_SUBDATA,        /* CPU copy uploaded with glBufferSubData */
+    LRBUFFERUPDATE_ORPHAN,         /* glBufferData(NULL) before each upload */
+    LRBUFFERUPDATE_MAPINVALIDATE,  /* glMapBufferRange, invalidating */
+    LRBUFFERUPDATE_UNSYNCHRONIZED, /* fenced ring, persistently mapped if available */
+    LRBUFFERUPDATE_COUNT
+} LRBUFFERUPDATE;
+
+typedef enum LRINDEXTYPE {
+    LRINDEXTYPE_USHORT, /* 16-bit, the default */
+    LRINDEXTYPE_UINT    /* 32-bit */
+} LRINDEXTYPE;
+
 typedef enum LRELEMENTTYPE {
     LRELEMENTTYPE_FLOAT,
     LRELEMENTTYPE_USHORT,
-    LRELEMENTTYPE_BYTE
+    LRELEMENTTYPE_BYTE,
+    LRELEMENTTYPE_HALF_FLOAT,
+    LRELEMENTTYPE_INT_2_10_10_10_REV, /* packed, elements must be 4 */
+    LRELEMENTTYPE_SHORT,
+    LRELEMENTTYPE_SBYTE
 } LRELEMENTTYPE;
 
 typedef enum LRELEMENTSLOT {
@@ -68,6 +86,15 @@ typedef enum LRELEMENTSLOT {
     LRELEMENTSLOT_COLOR2 = 10
 } LRELEMENTSLOT;
 
+/* Feature bits derived per draw, mapped to a collection's caps bits */
+typedef enum LRAUTOCAP {
+    LRAUTOCAP_LIGHTING,     /* draw has a lighting handle */
+    LRAUTOCAP_VERTEXCOLOR,  /* vertex declaration has a COLOR element */
+    LRAUTOCAP_NORMAL,       /* vertex declaration has a NORMAL element */
+    LRAUTOCAP_TEXTURE2,     /* vertex declaration has a TEXTURE2 element */
+    LRAUTOCAP_COUNT
+} LRAUTOCAP;
+
 typedef enum LRTEXTYPE {
     LRTEXTYPE_2D,
     LRTEXTYPE_CUBE
@@ -114,6 +141,7 @@ typedef struct LR_Texture LR_Texture;
 typedef struct LR_RenderTarget LR_RenderTarget;
 typedef struct LR_DynamicDraw LR_DynamicDraw;
 typedef struct LR_UniformBuffer LR_UniformBuffer;
+typedef struct LR_LODSet LR_LODSet;
 
 typedef struct LR_UniformBufferBinding {
     LR_UniformBuffer *buffer;
@@ -134,6 +162,42 @@ typedef struct LR_VertexElement {
     int offset;
 } LR_VertexElement;
 
+/* One entry of a batched static upload. baseVertex and startIndex are
+ * filled in with where the mesh was placed. indices match the geometry's
+ * LRINDEXTYPE. */
+typedef struct LR_StaticMesh {
+    void *vertices;
+    int vertexCount;
+    void *indices;
+    int indexCount;
+    int baseVertex;
+    int startIndex;
+} LR_StaticMesh;
+
+typedef struct LR_VertexCacheStats {
+    float acmrBefore;
+    float acmrAfter;
+} LR_VertexCacheStats;
+
+#define LR_MAX_LODS (8)
+/* A range of a geometry's index buffer. maxScreenSize is the largest
+ * projected bounding sphere diameter, in pixels of viewport height, the
+ * level is used for. It is ignored for level 0. */
+typedef struct LR_LODLevel {
+    int startIndex;
+    int indexCount;
+    float maxScreenSize;
+} LR_LODLevel;
+
+typedef struct LR_GeometryHeapStats {
+    int vertexCapacity;
+    int vertexUsed;
+    int vertexFreeRanges;
+    int indexCapacity;
+    int indexUsed;
+    int indexFreeRanges;
+} LR_GeometryHeapStats;
+
 typedef struct LR_Draw2D {
     LR_Texture *tex;
     int x;
@@ -166,24 +230,109 @@ LREXPORT const char *LR_GetString(LR_Context *ctx, LRSTRING string);
 LREXPORT void LR_GetContextFlags(LR_Context *ctx, LR_ContextFlags *flags);
 
 LREXPORT void LR_SetErrorCallback(LR_Context *ctx, LR_ErrorCallback cb);
+/* Shaders created afterwards are built from separately compiled stage programs
+ * combined in pipeline objects instead of being linked per variant pair.
+ * Returns 0 if GL_ARB_separate_shader_objects is unavailable. */
+LREXPORT int LR_SetSeparateShaders(LR_Context *ctx, int enable);
+/* Sets the update mode for the 2D renderer and buffers created afterwards.
+ * Defaults to LRBUFFERUPDATE_UNSYNCHRONIZED. */
+LREXPORT void LR_SetBufferUpdateMode(LR_Context *ctx, LRBUFFERUPDATE mode);
+LREXPORT LRBUFFERUPDATE LR_GetBufferUpdateMode(LR_Context *ctx);
+/* Times `iterations` uploads of `size` bytes with each mode and returns the
+ * fastest. outTimes (milliseconds, LRBUFFERUPDATE_COUNT entries) may be NULL.
+ * Call outside of a frame. */
+LREXPORT LRBUFFERUPDATE LR_BenchmarkBufferUpdates(LR_Context *ctx, int size, int iterations, double *outTimes);
 LREXPORT void LR_Destroy(LR_Context *ctx);
 
+/* Identical layouts return the same shared declaration.
+ * Every Create must be paired with a Free. */
 LREXPORT LR_VertexDeclaration* LR_VertexDeclaration_Create(LR_Context *ctx, int stride, int elemCount, LR_VertexElement *elements);
 LREXPORT void LR_VertexDeclaration_Free(LR_Context *ctx, LR_VertexDeclaration *decl);
+/* Converts count vertices between layouts, matching elements by slot.
+ * Destination elements missing from the source are filled with (0,0,0,1). */
+LREXPORT void LR_ConvertVertices(LR_VertexDeclaration *dstDecl, void *dst, LR_VertexDeclaration *srcDecl, const void *src, int count);
+LREXPORT uint16_t LR_FloatToHalf(float f);
+LREXPORT float LR_HalfToFloat(uint16_t h);
+/* signed normalized x,y,z in 10 bits each, w in 2 bits */
+LREXPORT uint32_t LR_PackSnorm1010102(float x, float y, float z, float w);
+
+/* Mesh optimisation for indexed triangle lists in caller memory. These need
+ * no context and can run offline. Return 0 on bad indices or allocation
+ * failure, leaving the data untouched. */
+/* average cache misses per triangle with a FIFO cache of cacheSize */
+LREXPORT float LR_MeshACMR(const void *indices, LRINDEXTYPE indexType, int indexCount, int vertexCount, int cacheSize);
+/* reorders triangles for post-transform cache hits (Forsyth). stats may be NULL */
+LREXPORT int LR_OptimizeVertexCache(void *indices, LRINDEXTYPE indexType, int indexCount, int vertexCount, LR_VertexCacheStats *stats);
+/* reorders vertices into first-use order and remaps the indices, run after
+ * LR_OptimizeVertexCache */
+LREXPORT int LR_OptimizeVertexFetch(void *vertices, int stride, int vertexCount, void *indices, LRINDEXTYPE indexType, int indexCount);
+/* Writes a coarser triangle list of at most targetIndexCount indices into
+ * outIndices (indexCount capacity) and returns its length. Positions are 3
+ * floats at positionOffset. The result indexes the same vertices, so it can
+ * be uploaded after the full mesh's indices as a LOD level. */
+LREXPORT int LR_SimplifyClustered(
+    const void *vertices,
+    int stride,
+    int positionOffset,
+    int vertexCount,
+    const void *indices,
+    LRINDEXTYPE indexType,
+    int indexCount,
+    int targetIndexCount,
+    void *outIndices
+);
 
+/* Begin returns memory in a GPU-visible ring. Data written between Begin and
+ * Finish stays valid until the end of the frame; draws are resolved against
+ * the most recent Begin. */
 LREXPORT LR_Geometry *LR_StreamingGeometry_Create(LR_Context *ctx, LR_VertexDeclaration *decl, int size, int idxSize);
+LREXPORT LR_Geometry *LR_StreamingGeometry_CreateEx(LR_Context *ctx, LR_VertexDeclaration *decl, int size, int idxSize, LRINDEXTYPE indexType);
 LREXPORT void LR_StreamingGeometry_SetIndices(LR_Context *ctx, LR_Geometry *geo, uint16_t *indices, int size);
+LREXPORT void LR_StreamingGeometry_SetIndices32(LR_Context *ctx, LR_Geometry *geo, uint32_t *indices, int size);
 LREXPORT void* LR_StreamingGeometry_Begin(LR_Context *ctx, LR_Geometry *geo);
 LREXPORT void* LR_StreamingGeometry_Resize(LR_Context *ctx, LR_Geometry *geo, int newSize);
 LREXPORT void LR_StreamingGeometry_Finish(LR_Context *ctx, LR_Geometry *geo, int count);
 
 LREXPORT uint16_t* LR_StreamingGeometry_BeginIndices(LR_Context *ctx, LR_Geometry *geo);
 LREXPORT uint16_t* LR_StreamingGeometry_ResizeIndices(LR_Context *ctx, LR_Geometry *geo, int newSize);
+/* for LRINDEXTYPE_UINT geometries */
+LREXPORT uint32_t* LR_StreamingGeometry_BeginIndices32(LR_Context *ctx, LR_Geometry *geo);
+LREXPORT uint32_t* LR_StreamingGeometry_ResizeIndices32(LR_Context *ctx, LR_Geometry *geo, int newSize);
 LREXPORT void LR_StreamingGeometry_FinishIndices(LR_Context *ctx, LR_Geometry *geo, int count);
+/* Must not be called between Begin and Finish */
+LREXPORT void LR_StreamingGeometry_SetUpdateMode(LR_Context *ctx, LR_Geometry *geo, LRBUFFERUPDATE mode);
 
 LREXPORT LR_Geometry *LR_StaticGeometry_Create(LR_Context *ctx, LR_VertexDeclaration *decl);
+LREXPORT LR_Geometry *LR_StaticGeometry_CreateEx(LR_Context *ctx, LR_VertexDeclaration *decl, LRINDEXTYPE indexType);
+/* size is in indices of the geometry's LRINDEXTYPE */
 LREXPORT void LR_StaticGeometry_UploadVertices(LR_Context *ctx, LR_Geometry *geo, void *data, int size, int *out_baseVertex);
 LREXPORT void LR_StaticGeometry_UploadIndices(LR_Context *ctx, LR_Geometry *geo, void *data, int size, int *out_startIndex);
+/* Makes room for vertexCount more vertices and indexCount more indices,
+ * so the following uploads never reallocate */
+LREXPORT void LR_StaticGeometry_Reserve(LR_Context *ctx, LR_Geometry *geo, int vertexCount, int indexCount);
+/* Appends all meshes with a single reservation and one write per buffer */
+LREXPORT void LR_StaticGeometry_UploadMeshes(LR_Context *ctx, LR_Geometry *geo, LR_StaticMesh *meshes, int count);
+
+/*
+ * Geometry heap: ranges of one vertex buffer and one index buffer sharing a
+ * single VAO, allocated and freed individually. Indices are relative to the
+ * range's base vertex. Ranges are referred to by handle and may move when the
+ * heap grows or is compacted, look up the current offsets with
+ * LR_GeometryHeap_GetRange when recording draws. Free and compact outside of
+ * a frame, recorded draws keep the offsets they were given.
+ */
+LREXPORT LR_Geometry *LR_GeometryHeap_Create(LR_Context *ctx, LR_VertexDeclaration *decl, int vertexCapacity, int indexCapacity);
+LREXPORT LR_Geometry *LR_GeometryHeap_CreateEx(LR_Context *ctx, LR_VertexDeclaration *decl, int vertexCapacity, int indexCapacity, LRINDEXTYPE indexType);
+LREXPORT LR_Handle LR_GeometryHeap_Alloc(LR_Context *ctx, LR_Geometry *geo, int vertexCount, int indexCount);
+LREXPORT void LR_GeometryHeap_Upload(LR_Context *ctx, LR_Geometry *geo, LR_Handle range, void *vertices, void *indices);
+LREXPORT void LR_GeometryHeap_GetRange(LR_Context *ctx, LR_Geometry *geo, LR_Handle range, int *out_baseVertex, int *out_startIndex);
+LREXPORT void LR_GeometryHeap_Free(LR_Context *ctx, LR_Geometry *geo, LR_Handle range);
+/* maxBytes <= 0 repacks everything into right-sized buffers. Otherwise moves
+ * up to maxBytes of data into lower holes and returns 1 if there may be more
+ * to do, for spreading compaction over several frames. */
+LREXPORT int LR_GeometryHeap_Compact(LR_Context *ctx, LR_Geometry *geo, int maxBytes);
+LREXPORT void LR_GeometryHeap_GetStats(LR_Context *ctx, LR_Geometry *geo, LR_GeometryHeapStats *stats);
+LREXPORT void LR_GeometryHeap_Destroy(LR_Context *ctx, LR_Geometry *geo);
 
 /*
 *  Called when a texture that has been unloaded is used.
@@ -240,12 +389,24 @@ LREXPORT void LR_RenderTarget_Destroy(LR_Context *ctx, LR_RenderTarget *rt);
 LREXPORT LR_UniformBuffer *LR_UniformBuffer_Create(LR_Context *ctx, int size, int stride);
 LREXPORT int LR_UniformBuffer_AlignIndex(LR_Context *ctx, LR_UniformBuffer *ubo, int index);
 LREXPORT void LR_UniformBuffer_SetData(LR_Context *ctx, LR_UniformBuffer *ubo, void* ptr, int stride, int start, int len);
+/* Uniform buffers take the context's mode when created. ORPHAN respecifies
+ * the whole buffer from a CPU copy. UNSYNCHRONIZED keeps a copy per frame in
+ * flight and writes whichever one the GPU is done with. */
+LREXPORT void LR_UniformBuffer_SetUpdateMode(LR_Context *ctx, LR_UniformBuffer *ubo, LRBUFFERUPDATE mode);
 LREXPORT void LR_UniformBuffer_Destroy(LR_Context *ctx, LR_UniformBuffer *ubo);
 /* Shaders */
+/* Compiled stages are cached per context, creating a shader from sources that
+ * were already linked returns the existing shader with its reference count raised */
 LREXPORT LR_Shader *LR_Shader_Create(LR_Context *ctx, const char *vertex_source, const char *fragment_source);
+LREXPORT void LR_Shader_Destroy(LR_Context *ctx, LR_Shader *shader);
 LREXPORT LR_ShaderCollection* LR_ShaderCollection_Create(LR_Context *ctx);
 LREXPORT void LR_ShaderCollection_AddDefaultShader(LR_Context *ctx, LR_ShaderCollection *col, int caps, LR_Shader *shader);
 LREXPORT void LR_ShaderCollection_AddShaderByVertex(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, int caps, LR_Shader *shader);
+/*
+ * Sets the caps bits (from lrshadertool feature flags) turned on when an automatic feature is present.
+ * Draws use the variant matching their caps exactly, or the one covering the most requested bits.
+ */
+LREXPORT void LR_ShaderCollection_SetAutoCap(LR_Context *ctx, LR_ShaderCollection *col, LRAUTOCAP cap, int capsBits);
 LREXPORT void LR_ShaderCollection_Destroy(LR_Context *ctx, LR_ShaderCollection *col);
 /* Materials */
 LREXPORT LR_Handle LR_Material_Create(LR_Context *ctx);
@@ -256,6 +417,8 @@ LREXPORT void LR_Material_SetSamplerName(LR_Context *ctx, LR_Handle material, in
 LREXPORT void LR_Material_SetSamplerTex(LR_Context *ctx, LR_Handle material, int index, LR_Texture *tex);
 LREXPORT void LR_Material_SetFragmentParameters(LR_Context *ctx, LR_Handle material, void *data, int size);
 LREXPORT void LR_Material_SetVertexParameters(LR_Context *ctx, LR_Handle material, void *data, int size);
+/* Feature bits always requested by this material, e.g. alpha test */
+LREXPORT void LR_Material_SetCaps(LR_Context *ctx, LR_Handle material, int caps);
 LREXPORT void LR_Material_SetUniformBlock(LR_Context *ctx, LR_Handle material, const char *uniformBlock);
 LREXPORT void LR_Material_Free(LR_Context *ctx, LR_Handle handle);
 /*
@@ -274,6 +437,11 @@ LREXPORT void LR_ClearDepth(LR_Context *ctx);
 /* Draw State */
 LREXPORT void LR_PushViewport(LR_Context *ctx, int x, int y, int width, int height);
 LREXPORT void LR_PopViewport(LR_Context *ctx);
+/*
+ * Shaders can read the camera from layout(std140) uniform Camera { mat4 View; mat4 Projection; mat4 ViewProjection; }
+ * and LR_SetLights data from a std140 block named Lighting. Both are written once per frame
+ * into a shared buffer, the View/Projection/ViewProjection uniforms are still set for older shaders.
+ */
 LREXPORT void LR_SetCamera(
     LR_Context *ctx, 
     LR_Matrix4x4 *view, 
@@ -283,6 +451,12 @@ LREXPORT void LR_SetCamera(
 LREXPORT void LR_Scissor(LR_Context *ctx, int x, int y, int width, int height);
 LREXPORT void LR_ClearScissor(LR_Context *ctx);
 /* Generic Drawing */
+/*
+ * Transforms are streamed to the GPU once per frame. Shaders can fetch them with
+ * layout(std140) uniform Transforms { mat4 TransformData[256]; }; uniform int TransformIndex;
+ * World is TransformData[TransformIndex], Normal is TransformData[TransformIndex + 1].
+ * The World and Normal uniforms are still set for shaders without the block.
+ */
 LREXPORT LR_Handle LR_AllocTransform(LR_Context *ctx, LR_Matrix4x4 *world, LR_Matrix4x4 *normal);
 LREXPORT LR_Handle LR_SetLights(LR_Context *ctx, void *data, int size);
 LREXPORT void LR_Draw(
@@ -298,6 +472,42 @@ LREXPORT void LR_Draw(
     int startIndex,
     int indexCount
 );
+/* LR_Draw with extra feature bits for this draw only */
+LREXPORT void LR_DrawWithCaps(
+    LR_Context *ctx,
+    LR_Handle material,
+    LR_Geometry *geometry,
+    LR_UniformBufferBinding *ubo, //Can be NULL
+    LR_Handle transform,
+    LR_Handle lighting,
+    LRPRIMTYPE primitive,
+    float zval,
+    int baseVertex,
+    int startIndex,
+    int indexCount,
+    int caps
+);
+/* Level of detail. Levels go from most to least detailed and share one
+ * baseVertex in geometry. sphere is a world space bounding sphere
+ * (x, y, z, radius) measured against the current camera and viewport. */
+LREXPORT LR_LODSet *LR_LODSet_Create(LR_Context *ctx, LR_Geometry *geometry, int baseVertex, LR_LODLevel *levels, int count);
+LREXPORT void LR_LODSet_Destroy(LR_Context *ctx, LR_LODSet *lods);
+/* projected diameter of sphere in pixels, -1 if the camera is inside it */
+LREXPORT float LR_ScreenSize(LR_Context *ctx, const float *sphere);
+LREXPORT int LR_LODSet_Select(LR_Context *ctx, LR_LODSet *lods, const float *sphere);
+/* draws the selected level as a triangle list and returns its index. Levels
+ * with an indexCount of 0 draw nothing */
+LREXPORT int LR_DrawLOD(
+    LR_Context *ctx,
+    LR_Handle material,
+    LR_LODSet *lods,
+    LR_UniformBufferBinding *ubo, //Can be NULL
+    LR_Handle transform,
+    LR_Handle lighting,
+    float zval,
+    const float *sphere,
+    int caps
+);
 /* Dynamic Drawing */
 LREXPORT LR_DynamicDraw *LR_DynamicDraw_Create(
     LR_Context *ctx, 
@@ -0,0 +1,88 @@
+#ifndef _LANCERRENDER_MESH_H_
+#define _LANCERRENDER_MESH_H_
+#include <lancerrender.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+
+/*
+ * Cooked mesh container written by lrmeshcook. Little endian, laid out so
+ * it can be memory mapped and uploaded without parsing:
+ *   LR_MeshFileHeader
+ *   LR_MeshFileSubmesh[submeshCount] at submeshOffset
+ *   vertices (vertexCount * vertexStride bytes) at vertexOffset
+ *   indices (indexCount of indexType) at indexOffset
+ * Offsets are multiples of LR_MESHFILE_ALIGN.
+ */
+#define LR_MESHFILE_MAGIC (0x48534D4C) /* "LMSH" */
+#define LR_MESHFILE_VERSION (1)
+#define LR_MESHFILE_ALIGN (64)
+#define LR_MESHFILE_MAXELEMENTS (16)
+#define LR_MESHFILE_NAMELENGTH (32)
+
+typedef struct LR_MeshFileElement {
+    uint8_t slot; /* LRELEMENTSLOT */
+    uint8_t type; /* LRELEMENTTYPE */
+    uint8_t elements;
+    uint8_t normalized;
+    uint32_t offset;
+} LR_MeshFileElement;
+
+typedef struct LR_MeshFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fileSize;
+    uint64_t submeshOffset;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexStride;
+    uint32_t elementCount; /* less than LR_MESHFILE_MAXELEMENTS */
+    uint32_t indexType; /* LRINDEXTYPE */
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t submeshCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    float sphere[4]; /* x, y, z, radius */
+    LR_MeshFileElement elements[LR_MESHFILE_MAXELEMENTS];
+} LR_MeshFileHeader;
+
+/* a range of the index buffer, indices are relative to vertex 0 */
+typedef struct LR_MeshFileSubmesh {
+    char name[LR_MESHFILE_NAMELENGTH];
+    uint32_t startIndex;
+    uint32_t indexCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    float sphere[4];
+} LR_MeshFileSubmesh;
+
+typedef enum {
+    LRMeshFileResult_OK = 0,
+    LRMeshFileResult_CANNOTOPEN = -1,
+    LRMeshFileResult_INVALIDORCORRUPT = -2,
+    LRMeshFileResult_UNSUPPORTEDVERSION = -3
+} LRMeshFileResult;
+
+typedef struct LR_MeshFile LR_MeshFile;
+
+/* Maps the file read-only and validates the header. Needs no context.
+ * result may be NULL. */
+LREXPORT LR_MeshFile *LR_MeshFile_Open(const char *path, LRMeshFileResult *result);
+LREXPORT void LR_MeshFile_Close(LR_MeshFile *file);
+LREXPORT const LR_MeshFileHeader *LR_MeshFile_GetHeader(LR_MeshFile *file);
+LREXPORT const LR_MeshFileSubmesh *LR_MeshFile_GetSubmeshes(LR_MeshFile *file);
+/* pointers into the mapping, valid until Close */
+LREXPORT const void *LR_MeshFile_GetVertices(LR_MeshFile *file);
+LREXPORT const void *LR_MeshFile_GetIndices(LR_MeshFile *file);
+LREXPORT LR_VertexDeclaration *LR_MeshFile_CreateDeclaration(LR_Context *ctx, LR_MeshFile *file);
+/* Appends the vertex and index blobs to a static geometry created with the
+ * file's declaration layout and index type, straight from the mapping.
+ * Submesh startIndex values are relative to out_startIndex. */
+LREXPORT void LR_MeshFile_Upload(LR_Context *ctx, LR_MeshFile *file, LR_Geometry *geo, int *out_baseVertex, int *out_startIndex);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
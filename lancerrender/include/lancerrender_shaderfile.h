@@ -8,6 +8,10 @@ extern "C" {
 
 LREXPORT void LR_ShaderCollection_DefaultShadersFromFile(LR_Context *ctx, LR_ShaderCollection *col, SDL_RWops *rw);
 LREXPORT void LR_ShaderCollection_AddShadersFromFile(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, SDL_RWops *rw);
+/* Only creates the variants whose caps appear in the list. Sources of other
+ * variants in version 2 files are skipped without being decompressed. */
+LREXPORT void LR_ShaderCollection_DefaultShadersFromFileCaps(LR_Context *ctx, LR_ShaderCollection *col, SDL_RWops *rw, const int *caps, int ncaps);
+LREXPORT void LR_ShaderCollection_AddShadersFromFileCaps(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, SDL_RWops *rw, const int *caps, int ncaps);
 
 
 #ifdef __cplusplus
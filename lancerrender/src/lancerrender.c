@@ -6,6 +6,7 @@
 #include "lr_dynamicdraw.h"
 #include "lr_rendertarget.h"
 #include "lr_ubo.h"
+#include "lr_shader.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -63,21 +64,30 @@ void LR_GLCheckError(LR_Context *ctx, const char *loc)
     }
 }
 
+void LR_BindUniformRange(LR_Context *ctx, int index, GLuint buffer, int offset, int size)
+{
+    LR_BufferRange *bound = &ctx->bound_ranges[index];
+    if(bound->buffer != buffer ||
+        bound->offset != offset ||
+        bound->size != size) {
+        bound->buffer = buffer;
+        bound->offset = offset;
+        bound->size = size;
+        GL_CHECK(ctx, glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size));
+    }
+}
+
 void LR_BindUniformBuffer(LR_Context *ctx, LR_UniformBufferBinding *binding)
 {
     if(!binding || !binding->buffer) return;
-    if(binding->buffer != ctx->bound_ubo.buffer ||
-        binding->start != ctx->bound_ubo.start ||
-        binding->count != ctx->bound_ubo.count) {
-            
-            ctx->bound_ubo = *binding;
-        GL_CHECK(ctx, glBindBufferRange(
-            GL_UNIFORM_BUFFER, 1, 
-            binding->buffer->gl,
-            binding->start * binding->buffer->stride,
-            binding->count * binding->buffer->stride
-        ));
-    }
+    LR_UniformBuffer *ubo = binding->buffer;
+    ubo->readFrame[ubo->current] = ctx->currentFrame;
+    LR_BindUniformRange(
+        ctx, LR_UBO_BINDING_USER,
+        ubo->gl,
+        ubo->current * ubo->copyStride + binding->start * ubo->stride,
+        binding->count * ubo->stride
+    );
 }
 
 void LR_SetDepthMode(LR_Context *ctx, int depthMode)
@@ -118,6 +128,14 @@ static void CheckExtensions(LR_Context *ctx)
         }
         if(!xAni) break;
     }
+    /* also enables glProgramUniform* for linked programs */
+    ctx->separateShaders = !ctx->gles && GLAD_GL_ARB_separate_shader_objects;
+    /* persistently mapped streaming buffers */
+    ctx->bufferStorage = !ctx->gles && GLAD_GL_ARB_buffer_storage;
+    /* core in GL 3.3 and GL ES 3.0 */
+    ctx->packedVertices = ctx->gles || GLAD_GL_ARB_vertex_type_2_10_10_10_rev;
+    /* one VAO per vertex declaration, buffers attached at bind */
+    ctx->vertexAttribBinding = !ctx->gles && GLAD_GL_ARB_vertex_attrib_binding;
 }
 
 LREXPORT void LR_GetContextFlags(LR_Context *ctx, LR_ContextFlags *flags)
@@ -144,13 +162,18 @@ LREXPORT LR_Context *LR_Init(int gles)
         LRVEC_ADD_VAL(ctx, &ctx->flags, char*, "Software S3TC");
     }
     CheckExtensions(ctx);
+    ctx->bufferUpdate = LRBUFFERUPDATE_UNSYNCHRONIZED;
+    LRVEC_INIT(&ctx->shaderStages, LR_ShaderStage*, 16);
+    LRVEC_INIT(&ctx->shaders, LR_Shader*, 16);
+    LRVEC_INIT(&ctx->declarations, LR_VertexDeclaration*, 16);
     ctx->ren2d = LR_2D_Init(ctx);
     ctx->cullMode = LRCULL_CCW;
     ctx->depthWrite = 1;
     glGetIntegerv(GL_MAX_SAMPLES, &ctx->maxSamples);
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ctx->uboOffsetAlign);
+    LR_UniformRing_Init(ctx, &ctx->uniformRing, LR_INITIAL_UNIFORMRING_SIZE, LR_UNIFORMRING_SLACK);
     LRVEC_INIT(&ctx->commands, LR_DrawCommand, LR_INITIAL_CAPACITY);
-    LRVEC_INIT(&ctx->transforms, LR_Matrix4x4, LR_INITIAL_TRANSFORM_CAPACITY);
+    LR_UniformRing_Init(ctx, &ctx->transformRing, LR_INITIAL_TRANSFORM_CAPACITY * sizeof(LR_Matrix4x4), LR_TRANSFORM_BLOCK_SIZE);
     LRVEC_INIT(&ctx->tempMaterials, LR_Handle, 16);
     ctx->lightingInfo = malloc(LR_INITIAL_CAPACITY * 64);
     ctx->lightingSize = LR_INITIAL_CAPACITY * 64;
@@ -181,6 +204,24 @@ LREXPORT int LR_GetMaxAnisotropy(LR_Context *ctx)
     return ctx->maxAnisotropy;
 }
 
+LREXPORT int LR_SetSeparateShaders(LR_Context *ctx, int enable)
+{
+    ctx->useSeparateShaders = enable && ctx->separateShaders;
+    return ctx->useSeparateShaders || !enable;
+}
+
+LREXPORT void LR_SetBufferUpdateMode(LR_Context *ctx, LRBUFFERUPDATE mode)
+{
+    LR_AssertTrue(ctx, mode >= 0 && mode < LRBUFFERUPDATE_COUNT);
+    ctx->bufferUpdate = mode;
+    LR_2D_SetUpdateMode(ctx, ctx->ren2d, mode);
+}
+
+LREXPORT LRBUFFERUPDATE LR_GetBufferUpdateMode(LR_Context *ctx)
+{
+    return ctx->bufferUpdate;
+}
+
 #define OFFSET_PTR(type,ptr,offset)(  (type*)(&((char*)(ptr))[(offset)])  )
 #define ALIGN_VEC4(x) ((x) + (-(x) & 15))
 
@@ -215,18 +256,26 @@ LREXPORT LR_Handle LR_SetLights(LR_Context *ctx, void *data, int size)
             *OFFSET_PTR(char, ctx->lightingInfo, ctx->lightingPtr + sizeof(LR_LightingInfo) + i) = 0;
         }
     }
+    //copy to the frame's uniform buffer for shaders using a Lighting block
+    info->uboOffset = LR_UniformRing_Alloc(ctx, &ctx->uniformRing, allocSize, ctx->uboOffsetAlign);
+    memcpy(
+        LR_UniformRing_Ptr(&ctx->uniformRing, info->uboOffset),
+        OFFSET_PTR(void, ctx->lightingInfo, ctx->lightingPtr + sizeof(LR_LightingInfo)),
+        allocSize
+    );
     LR_Handle handle = ctx->lightingPtr + 1;
     ctx->lightingPtr += allocSize + sizeof(LR_LightingInfo);
     ctx->lastLighting = handle;
     return handle;
 }
 
-int LR_GetLightingInfo(LR_Context *ctx, LR_Handle h, int *outSize, void **outData)
+int LR_GetLightingInfo(LR_Context *ctx, LR_Handle h, int *outSize, void **outData, int *outOffset)
 {
     if(!h) return 0;
     LR_LightingInfo info = *OFFSET_PTR(LR_LightingInfo, ctx->lightingInfo, h - 1);
     *outData = OFFSET_PTR(void, ctx->lightingInfo, h - 1 + sizeof(LR_LightingInfo));
     *outSize = info.size;
+    *outOffset = info.uboOffset;
     return info.hash;
 }
 
@@ -252,6 +301,15 @@ void LR_BindProgram(LR_Context *ctx, GLuint program)
     }
 }
 
+/* only takes effect while program 0 is bound */
+void LR_BindPipeline(LR_Context *ctx, GLuint pipeline)
+{
+    if(ctx->bound_pipeline != pipeline) {
+        ctx->bound_pipeline = pipeline;
+        GL_CHECK(ctx, glBindProgramPipeline(pipeline));
+    }
+}
+
 void LR_UnbindTex(LR_Context *ctx, GLuint tex)
 {
     for(int i = 0; i < LR_MAX_TEXTURES; i++) {
@@ -377,6 +435,8 @@ static void LR_FlushDraws(LR_Context *ctx)
 {
     LR_Flush2D(ctx);
     if(!ctx->commands.currIdx) return;
+    LR_UniformRing_Upload(ctx, &ctx->uniformRing);
+    LR_UniformRing_Upload(ctx, &ctx->transformRing);
     LR_CmdSort(ctx);
     LR_DynamicDraw *lastDD = NULL; //Dynamic drawing
     for(int i = 0; i < ctx->commands.currIdx; i++) {
@@ -387,12 +447,12 @@ static void LR_FlushDraws(LR_Context *ctx)
                 lastDD = NULL;
             }
             LR_Material_Prepare(ctx, cmd->geometry->decl, cmd);
-            LR_BindVAO(ctx, cmd->geometry->vao);
+            LR_Geometry_Bind(ctx, cmd->geometry);
             GL_CHECK(ctx, glDrawElementsBaseVertex(
                 GLPrim(ctx, cmd->g.primitive),
                 cmd->g.countIndex,
-                GL_UNSIGNED_SHORT,
-                GL_OFFSET(cmd->g.startIndex * 2),
+                LR_IndexGLType(cmd->geometry->indexType),
+                GL_OFFSET(cmd->g.startIndex * LR_IndexSize(cmd->geometry->indexType)),
                 cmd->g.baseVertex)
             );
         } else {
@@ -409,6 +469,16 @@ static void LR_FlushDraws(LR_Context *ctx)
     ctx->commands.currIdx = 0;
 }
 
+/* Writes the Camera block for the current camera into the frame's uniform data */
+static void LR_PushCamera(LR_Context *ctx)
+{
+    ctx->cameraOffset = LR_UniformRing_Alloc(ctx, &ctx->uniformRing, LR_CAMERA_BLOCK_SIZE, ctx->uboOffsetAlign);
+    LR_Matrix4x4 *block = (LR_Matrix4x4*)LR_UniformRing_Ptr(&ctx->uniformRing, ctx->cameraOffset);
+    block[0] = ctx->view;
+    block[1] = ctx->projection;
+    block[2] = ctx->viewprojection;
+}
+
 LREXPORT void LR_SetCamera(
     LR_Context *ctx, 
     LR_Matrix4x4 *view, 
@@ -423,6 +493,9 @@ LREXPORT void LR_SetCamera(
     ctx->view = *view;
     ctx->projection = *projection;
     ctx->viewprojection = *viewprojection;
+    if(ctx->inframe) {
+        LR_PushCamera(ctx);
+    }
 }
 
 static void LR_AddCommand(LR_Context *ctx, LR_DrawCommand *cmd)
@@ -431,12 +504,14 @@ static void LR_AddCommand(LR_Context *ctx, LR_DrawCommand *cmd)
     LRVEC_ADD_VAL(ctx, &ctx->commands, LR_DrawCommand, *cmd);
 }
 
-static void LR_AddTransform(LR_Context *ctx, LR_Matrix4x4 *world, LR_Matrix4x4 *normal)
+static LR_Handle LR_AddTransform(LR_Context *ctx, LR_Matrix4x4 *world, LR_Matrix4x4 *normal)
 {
-    int ptr = ctx->transforms.currIdx;
-    LRVEC_ADD(ctx, &ctx->transforms, LR_Matrix4x4, 2);
-    LRVEC_IDX(&ctx->transforms, LR_Matrix4x4, ptr) = *world;
-    LRVEC_IDX(&ctx->transforms, LR_Matrix4x4, ptr + 1) = *normal;
+    /* tightly packed, so the handle is the matrix index within the frame */
+    int offset = LR_UniformRing_Alloc(ctx, &ctx->transformRing, 2 * sizeof(LR_Matrix4x4), 0);
+    LR_Handle handle = (LR_Handle)(offset / sizeof(LR_Matrix4x4));
+    LR_TransformPtr(ctx, handle)[0] = *world;
+    LR_TransformPtr(ctx, handle)[1] = *normal;
+    return handle;
 }
 
 LREXPORT void LR_ClearDepth(LR_Context *ctx)
@@ -451,9 +526,7 @@ LREXPORT void LR_ClearDepth(LR_Context *ctx)
 LREXPORT LR_Handle LR_AllocTransform(LR_Context *ctx, LR_Matrix4x4 *world, LR_Matrix4x4 *normal)
 {
     FRAME_CHECK_RET("LR_AllocTransform", -1);
-    LR_Handle retval = (LR_Handle)ctx->transforms.currIdx;
-    LR_AddTransform(ctx, world, normal);
-    return retval;
+    return LR_AddTransform(ctx, world, normal);
 }
 
 LREXPORT void LR_BeginFrame(LR_Context *ctx, int width, int height)
@@ -464,9 +537,12 @@ LREXPORT void LR_BeginFrame(LR_Context *ctx, int width, int height)
     GL_CHECK(ctx, glViewport(0, 0, width, height));
     ctx->inframe = 1;
     ctx->currentFrame++;
-    ctx->transforms.currIdx = 0;
+    LR_UniformRing_BeginFrame(ctx, &ctx->transformRing);
+    ctx->transformWindow = -1;
     ctx->lightingPtr = 0;
     ctx->lastLighting = 0;
+    LR_UniformRing_BeginFrame(ctx, &ctx->uniformRing);
+    LR_PushCamera(ctx);
 }
 
 LREXPORT void LR_SetRenderTarget(LR_Context *ctx, LR_RenderTarget *rt)
@@ -548,6 +624,8 @@ LREXPORT void LR_EndFrame(LR_Context *ctx)
         LR_Material_Free(ctx, LRVEC_IDX(&ctx->tempMaterials, LR_Handle, i));
     }
     ctx->tempMaterials.currIdx = 0;
+    LR_UniformRing_EndFrame(ctx, &ctx->uniformRing);
+    LR_UniformRing_EndFrame(ctx, &ctx->transformRing);
     ctx->inframe = 0;
     if(ctx->bound_fbo) {
         ctx->bound_fbo = 0;
@@ -568,6 +646,24 @@ LREXPORT void LR_Draw(
     int startIndex,
     int indexCount
 )
+{
+    LR_DrawWithCaps(ctx, material, geometry, ubo, transform, lighting, primitive, zval, baseVertex, startIndex, indexCount, 0);
+}
+
+LREXPORT void LR_DrawWithCaps(
+    LR_Context *ctx,
+    LR_Handle material,
+    LR_Geometry *geometry,
+    LR_UniformBufferBinding *ubo,
+    LR_Handle transform,
+    LR_Handle lighting,
+    LRPRIMTYPE primitive,
+    float zval,
+    int baseVertex,
+    int startIndex,
+    int indexCount,
+    int caps
+)
 {
     FRAME_CHECK_VOID("LR_Draw");
     uint64_t key = 0;
@@ -580,6 +676,11 @@ LREXPORT void LR_Draw(
         uint32_t revZ = 0x7FFFFFFF - (LR_F32ToUI32(zval) >> 1);
         key = (1ULL << 63) | (uint64_t)(material << 31) | revZ;
     }
+    if(geometry->type == LRGTYPE_STREAMING) {
+        /* streamed data moves through a ring, resolve against the last Begin */
+        baseVertex += LR_StreamingGeometry_BaseVertex(geometry);
+        startIndex += LR_StreamingGeometry_BaseIndex(geometry);
+    }
     LR_UniformBufferBinding nullBinding = { .buffer = NULL };
     if(ubo && ubo->buffer) {
         LR_AssertTrue(ctx, LR_UniformBuffer_AlignIndex(ctx, ubo->buffer, ubo->start) == ubo->start);
@@ -595,6 +696,7 @@ LREXPORT void LR_Draw(
             .baseVertex = baseVertex,
             .startIndex = startIndex,
             .countIndex = indexCount,
+            .caps = caps,
             .uboBinding = ubo ? *ubo : nullBinding
         }
     };
@@ -606,8 +708,11 @@ LREXPORT void LR_Destroy(LR_Context *ctx)
     LR_AssertTrue(ctx, !ctx->inframe);
     blockalloc_Destroy(ctx->materials);
     LR_2D_Destroy(ctx, ctx->ren2d);
+    LR_VertexDeclaration_DestroyAll(ctx);
+    LR_Shader_DestroyCache(ctx);
+    LR_UniformRing_Destroy(ctx, &ctx->uniformRing);
     LRVEC_FREE(ctx, &ctx->commands, LR_DrawCommand);
-    LRVEC_FREE(ctx, &ctx->transforms, LR_Matrix4x4);
+    LR_UniformRing_Destroy(ctx, &ctx->transformRing);
     LRVEC_FREE(ctx, &ctx->flags, char*);
     free((void*)ctx);
 }
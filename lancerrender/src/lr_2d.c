@@ -146,7 +146,7 @@ void LR_Flush2D(LR_Context *ctx)
     r2d->vertices = 0;
     if(!r2d->vCount) return;
     //bind
-    LR_BindVAO(ctx, r2d->geom->vao);
+    LR_Geometry_Bind(ctx, r2d->geom);
     if(!LR_Texture_EnsureLoaded(ctx, r2d->currentTexture))
         LR_CriticalErrorFunc(ctx, "Texture not resident @ LR_Flush2D");
     LR_BindTex(ctx, 1, r2d->currentTexture->target, r2d->currentTexture->textureObj);
@@ -165,11 +165,23 @@ void LR_Flush2D(LR_Context *ctx)
         glUniformMatrix4fv(r2d->modelviewproj, 1, GL_FALSE, (GLfloat*)&viewproj);
     }
     //draw
-    GL_CHECK(ctx, glDrawElements(GL_TRIANGLES, (r2d->vCount / 4) * 6, GL_UNSIGNED_SHORT, 0));
+    GL_CHECK(ctx, glDrawElementsBaseVertex(
+        GL_TRIANGLES,
+        (r2d->vCount / 4) * 6,
+        LR_IndexGLType(r2d->geom->indexType),
+        0,
+        LR_StreamingGeometry_BaseVertex(r2d->geom)
+    ));
     r2d->vCount = 0;
     r2d->currentTexture = NULL;
 }
 
+void LR_2D_SetUpdateMode(LR_Context *ctx, LR_2D *r2d, LRBUFFERUPDATE mode)
+{
+    LR_Flush2D(ctx);
+    LR_StreamingGeometry_SetUpdateMode(ctx, r2d->geom, mode);
+}
+
 #define BUILD_VERTEX(indexer,_x,_y,_u,_v,_color) do { \
     Vertex2D *vert = &indexer; \
     vert->x = (_x); \
@@ -265,6 +277,7 @@ void LR_2D_Destroy(LR_Context *ctx, LR_2D *r2d)
 {
     LR_VertexDeclaration_Free(ctx, r2d->decl);
     LR_Texture_Destroy(ctx, r2d->dot);
+    LR_Shader_Destroy(ctx, r2d->shader);
     free(r2d);
 }
 
@@ -4,6 +4,7 @@
 typedef struct LR_2D LR_2D;
 LR_2D *LR_2D_Init();
 void LR_Flush2D(LR_Context *ctx);
+void LR_2D_SetUpdateMode(LR_Context *ctx, LR_2D *r2d, LRBUFFERUPDATE mode);
 void LR_2D_Destroy(LR_Context *ctx, LR_2D *r2d);
 
 #endif
\ No newline at end of file
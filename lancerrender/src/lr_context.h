@@ -4,6 +4,7 @@
 #include "lr_errors.h"
 #include "lr_blockalloc.h"
 #include "lr_vector.h"
+#include "lr_uniformring.h"
 #include <stdint.h>
 #include <glad/glad.h>
 
@@ -12,6 +13,21 @@
 #define LR_MAX_MATERIAL_ADDRESS (1U << 23)
 #define LR_INITIAL_CAPACITY (256)
 #define LR_INITIAL_TRANSFORM_CAPACITY (256)
+#define LR_INITIAL_UNIFORMRING_SIZE (64 * 1024)
+#define LR_UNIFORMRING_SLACK (16 * 1024) /* GL minimum for MAX_UNIFORM_BLOCK_SIZE */
+
+/* uniform buffer binding points */
+#define LR_UBO_BINDING_USER (1)
+#define LR_UBO_BINDING_CAMERA (2)
+#define LR_UBO_BINDING_LIGHTING (3)
+#define LR_UBO_BINDING_TRANSFORMS (4)
+#define LR_MAX_UBO_BINDINGS (5)
+
+/* layout(std140) uniform Camera { mat4 View; mat4 Projection; mat4 ViewProjection; }; */
+#define LR_CAMERA_BLOCK_SIZE (3 * sizeof(LR_Matrix4x4))
+/* layout(std140) uniform Transforms { mat4 TransformData[256]; }; indexed by uniform int TransformIndex */
+#define LR_TRANSFORM_BLOCK_MATRICES (256)
+#define LR_TRANSFORM_BLOCK_SIZE (LR_TRANSFORM_BLOCK_MATRICES * sizeof(LR_Matrix4x4))
 
 typedef struct LR_Viewport {
     int x;
@@ -30,6 +46,7 @@ typedef struct {
     int baseVertex;
     int startIndex;
     int countIndex;
+    int caps;
 } LR_Geometry_Command;
 
 typedef struct {
@@ -57,8 +74,15 @@ typedef struct LR_DrawCommand {
 typedef struct LR_LightingInfo {
     int size;
     int hash;
+    int uboOffset;
 } LR_LightingInfo;
 
+typedef struct LR_BufferRange {
+    GLuint buffer;
+    int offset;
+    int size;
+} LR_BufferRange;
+
 struct LR_Context {
     /* context info */
     int gles;
@@ -70,16 +94,23 @@ struct LR_Context {
     int maxAnisotropy;
     int maxSamples;
     int uboOffsetAlign;
+    int separateShaders;
+    int useSeparateShaders;
+    int bufferStorage;
+    int packedVertices;
+    int vertexAttribBinding;
+    LRBUFFERUPDATE bufferUpdate;
     int scissorEnabled;
     LRCULL cullMode;
     int blendEnabled;
     LRBLEND srcblend;
     LRBLEND destblend;
     GLuint bound_program;
+    GLuint bound_pipeline;
     GLuint bound_vao;
     GLuint bound_textures[LR_MAX_TEXTURES];
     GLuint bound_fbo;
-    LR_UniformBufferBinding bound_ubo;
+    LR_BufferRange bound_ranges[LR_MAX_UBO_BINDINGS];
     int currentUnit;
     int depthMode;
     int depthWrite;
@@ -87,11 +118,17 @@ struct LR_Context {
     BlockAlloc *materials;
     LR_Vector tempMaterials;
     LR_2D *ren2d;
+    LR_Vector shaderStages;
+    LR_Vector shaders;
+    LR_Vector declarations;
     /* camera */
     int vp_version;
     LR_Matrix4x4 view;
     LR_Matrix4x4 projection;
     LR_Matrix4x4 viewprojection;
+    int cameraOffset;
+    /* per-frame uniform data */
+    LR_UniformRing uniformRing;
     /* frame */
     int inframe;
     /* viewport */
@@ -99,7 +136,8 @@ struct LR_Context {
     LR_Viewport viewports[LR_MAX_VIEWPORTS];
     /* transforms */
     int currentFrame;
-    LR_Vector transforms;
+    LR_UniformRing transformRing;
+    int transformWindow;
     /* commands */
     LR_Vector commands;
     /* lighting */
@@ -123,18 +161,22 @@ static inline uint32_t LR_F32ToUI32(float flt)
 
 
 
+/* transform handles index matrices in the frame's transform buffer */
+#define LR_TransformPtr(ctx, h) ((LR_Matrix4x4*)LR_UniformRing_Ptr(&(ctx)->transformRing, (h) * sizeof(LR_Matrix4x4)))
+
 #define LR_LightingInfoPtr(x) ((void*)((char*)(x) + sizeof(LR_LightingInfo)))
 
 #define FRAME_CHECK_VOID(name) do { if(!ctx->inframe) { LR_CriticalErrorFunc(ctx, #name " must call LR_BeginFrame"); return; } } while (0)
 #define FRAME_CHECK_RET(name, x) do { if(!ctx->inframe) { LR_CriticalErrorFunc(ctx, #name " must call LR_BeginFrame"); return (x); } } while (0)
 #define GL_OFFSET(x) ((void*)(uintptr_t)(x))
 
-int LR_GetLightingInfo(LR_Context *ctx, LR_Handle h, int *outSize, void **outData);
+int LR_GetLightingInfo(LR_Context *ctx, LR_Handle h, int *outSize, void **outData, int *outOffset);
 
 /* defined in lr_sort.c */
 void LR_CmdSort(LR_Context *ctx);
 /* GL State */
 void LR_BindProgram(LR_Context *ctx, GLuint program);
+void LR_BindPipeline(LR_Context *ctx, GLuint pipeline);
 void LR_BindVAO(LR_Context *ctx, GLuint vao);
 void LR_UnbindTex(LR_Context *ctx, GLuint tex);
 void LR_BindTex(LR_Context *ctx, int unit, GLenum target, GLuint tex);
@@ -144,4 +186,5 @@ void LR_SetBlendMode(LR_Context *ctx, int blendEnabled, LRBLEND srcblend, LRBLEN
 void LR_SetCull(LR_Context *ctx, LRCULL cull);
 void LR_SetDepthMode(LR_Context *ctx, int depthMode);
 void LR_BindUniformBuffer(LR_Context *ctx, LR_UniformBufferBinding *binding);
+void LR_BindUniformRange(LR_Context *ctx, int index, GLuint buffer, int offset, int size);
 #endif
@@ -0,0 +1,228 @@
+#include "lr_geometry.h"
+#include <string.h>
+
+/* CPU conversion between vertex layouts, for importers packing float data
+ * into the compact element types */
+
+typedef union {
+    float f;
+    uint32_t u;
+} FloatBits;
+
+LREXPORT uint16_t LR_FloatToHalf(float f)
+{
+    FloatBits v;
+    v.f = f;
+    uint32_t x = v.u;
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7FFFFF;
+    if(((x >> 23) & 0xFF) == 0xFF) //inf, nan
+        return sign | 0x7C00 | (mant ? 0x200 : 0);
+    int exp = (int)((x >> 23) & 0xFF) - 127 + 15;
+    if(exp >= 31) return sign | 0x7C00;
+    uint32_t half, rem, mid;
+    if(exp <= 0) {
+        //denormal
+        if(exp < -10) return sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        half = mant >> shift;
+        rem = mant & ((1U << shift) - 1);
+        mid = 1U << (shift - 1);
+    } else {
+        half = ((uint32_t)exp << 10) | (mant >> 13);
+        rem = mant & 0x1FFF;
+        mid = 0x1000;
+    }
+    //round to nearest even, a carry into the exponent is still correct
+    if(rem > mid || (rem == mid && (half & 1))) half++;
+    return sign | half;
+}
+
+LREXPORT float LR_HalfToFloat(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    FloatBits v;
+    if(exp == 0) {
+        if(!mant) {
+            v.u = sign;
+        } else {
+            exp = 127 - 14;
+            while(!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            v.u = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+        }
+    } else if(exp == 31) {
+        v.u = sign | 0x7F800000 | (mant << 13);
+    } else {
+        v.u = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    }
+    return v.f;
+}
+
+static inline int RoundInt(float f)
+{
+    return (int)(f + (f >= 0 ? 0.5f : -0.5f));
+}
+
+static inline float Clamp(float f, float min, float max)
+{
+    return f < min ? min : (f > max ? max : f);
+}
+
+LREXPORT uint32_t LR_PackSnorm1010102(float x, float y, float z, float w)
+{
+    uint32_t px = (uint32_t)RoundInt(Clamp(x, -1, 1) * 511.0f) & 0x3FF;
+    uint32_t py = (uint32_t)RoundInt(Clamp(y, -1, 1) * 511.0f) & 0x3FF;
+    uint32_t pz = (uint32_t)RoundInt(Clamp(z, -1, 1) * 511.0f) & 0x3FF;
+    uint32_t pw = (uint32_t)RoundInt(Clamp(w, -1, 1)) & 0x3;
+    return px | (py << 10) | (pz << 20) | (pw << 30);
+}
+
+/* sign extends the low `bits` bits of v */
+static inline int SignExtend(uint32_t v, int bits)
+{
+    uint32_t m = 1U << (bits - 1);
+    v &= (1U << bits) - 1;
+    return (int)(v ^ m) - (int)m;
+}
+
+static float Normalize(int v, int max, int isSigned)
+{
+    float f = (float)v / (float)max;
+    if(isSigned && f < -1.0f) f = -1.0f;
+    return f;
+}
+
+static int Quantize(float f, int normalized, int min, int max)
+{
+    if(normalized) f *= (float)max;
+    return RoundInt(Clamp(f, (float)min, (float)max));
+}
+
+static void ReadElement(const char *src, LR_VertexElement *e, float out[4])
+{
+    out[0] = out[1] = out[2] = 0;
+    out[3] = 1;
+    if(e->type == LRELEMENTTYPE_INT_2_10_10_10_REV) {
+        uint32_t p;
+        memcpy(&p, src, 4);
+        int v[4] = { SignExtend(p, 10), SignExtend(p >> 10, 10), SignExtend(p >> 20, 10), SignExtend(p >> 30, 2) };
+        for(int i = 0; i < 4; i++) {
+            int max = i == 3 ? 1 : 511;
+            out[i] = e->normalized ? Normalize(v[i], max, 1) : (float)v[i];
+        }
+        return;
+    }
+    for(int i = 0; i < e->elements && i < 4; i++) {
+        switch(e->type) {
+            case LRELEMENTTYPE_HALF_FLOAT:
+            {
+                uint16_t h;
+                memcpy(&h, src + i * 2, 2);
+                out[i] = LR_HalfToFloat(h);
+                break;
+            }
+            case LRELEMENTTYPE_USHORT:
+            {
+                uint16_t s;
+                memcpy(&s, src + i * 2, 2);
+                out[i] = e->normalized ? Normalize(s, 65535, 0) : (float)s;
+                break;
+            }
+            case LRELEMENTTYPE_SHORT:
+            {
+                int16_t s;
+                memcpy(&s, src + i * 2, 2);
+                out[i] = e->normalized ? Normalize(s, 32767, 1) : (float)s;
+                break;
+            }
+            case LRELEMENTTYPE_BYTE:
+                out[i] = e->normalized ? Normalize((uint8_t)src[i], 255, 0) : (float)(uint8_t)src[i];
+                break;
+            case LRELEMENTTYPE_SBYTE:
+                out[i] = e->normalized ? Normalize((int8_t)src[i], 127, 1) : (float)(int8_t)src[i];
+                break;
+            default:
+                memcpy(&out[i], src + i * 4, 4);
+                break;
+        }
+    }
+}
+
+static void WriteElement(char *dst, LR_VertexElement *e, const float in[4])
+{
+    if(e->type == LRELEMENTTYPE_INT_2_10_10_10_REV) {
+        uint32_t p = 0;
+        for(int i = 0; i < 4; i++) {
+            int bits = i == 3 ? 2 : 10;
+            int max = (1 << (bits - 1)) - 1;
+            int v = Quantize(in[i], e->normalized, -max - 1, max);
+            p |= ((uint32_t)v & ((1U << bits) - 1)) << (i * 10);
+        }
+        memcpy(dst, &p, 4);
+        return;
+    }
+    for(int i = 0; i < e->elements && i < 4; i++) {
+        switch(e->type) {
+            case LRELEMENTTYPE_HALF_FLOAT:
+            {
+                uint16_t h = LR_FloatToHalf(in[i]);
+                memcpy(dst + i * 2, &h, 2);
+                break;
+            }
+            case LRELEMENTTYPE_USHORT:
+            {
+                uint16_t s = (uint16_t)Quantize(in[i], e->normalized, 0, 65535);
+                memcpy(dst + i * 2, &s, 2);
+                break;
+            }
+            case LRELEMENTTYPE_SHORT:
+            {
+                int16_t s = (int16_t)Quantize(in[i], e->normalized, -32768, 32767);
+                memcpy(dst + i * 2, &s, 2);
+                break;
+            }
+            case LRELEMENTTYPE_BYTE:
+                dst[i] = (char)(uint8_t)Quantize(in[i], e->normalized, 0, 255);
+                break;
+            case LRELEMENTTYPE_SBYTE:
+                dst[i] = (char)(int8_t)Quantize(in[i], e->normalized, -128, 127);
+                break;
+            default:
+                memcpy(dst + i * 4, &in[i], 4);
+                break;
+        }
+    }
+}
+
+LREXPORT void LR_ConvertVertices(LR_VertexDeclaration *dstDecl, void *dst, LR_VertexDeclaration *srcDecl, const void *src, int count)
+{
+    /* match elements by slot, unmatched destination elements get (0,0,0,1) */
+    LR_VertexElement *match[LR_MAXVERTEXELEMENTS];
+    for(int i = 0; i < dstDecl->elemCount; i++) {
+        match[i] = NULL;
+        for(int j = 0; j < srcDecl->elemCount; j++) {
+            if(srcDecl->elements[j].slot == dstDecl->elements[i].slot) {
+                match[i] = &srcDecl->elements[j];
+                break;
+            }
+        }
+    }
+    const char *s = (const char*)src;
+    char *d = (char*)dst;
+    for(int v = 0; v < count; v++) {
+        memset(d, 0, dstDecl->stride);
+        for(int i = 0; i < dstDecl->elemCount; i++) {
+            float value[4] = { 0, 0, 0, 1 };
+            if(match[i]) ReadElement(s + match[i]->offset, match[i], value);
+            WriteElement(d + dstDecl->elements[i].offset, &dstDecl->elements[i], value);
+        }
+        s += srcDecl->stride;
+        d += dstDecl->stride;
+    }
+}
@@ -84,7 +84,7 @@ void LR_DynamicDraw_Flush(LR_Context *ctx, LR_DynamicDraw *dd)
 {
     if(!dd->indexPtr) return;
     LR_StreamingGeometry_FinishIndices(ctx, dd->streamingGeometry, dd->indexPtr);
-    LR_BindVAO(ctx, dd->streamingGeometry->vao);
+    LR_Geometry_Bind(ctx, dd->streamingGeometry);
     if(dd->samplerIndex != -1) {
         LR_Material_SetSamplerTex(ctx, dd->material, dd->samplerIndex, dd->lastDrawTex);
     }
@@ -93,7 +93,13 @@ void LR_DynamicDraw_Flush(LR_Context *ctx, LR_DynamicDraw *dd)
         .geometry = NULL
     };
     LR_Material_Prepare(ctx, dd->decl, &cmd);
-    GL_CHECK(ctx, glDrawElements(GL_TRIANGLES, dd->indexPtr, GL_UNSIGNED_SHORT, NULL));
+    GL_CHECK(ctx, glDrawElementsBaseVertex(
+        GL_TRIANGLES,
+        dd->indexPtr,
+        LR_IndexGLType(dd->streamingGeometry->indexType),
+        GL_OFFSET(LR_StreamingGeometry_BaseIndex(dd->streamingGeometry) * LR_IndexSize(dd->streamingGeometry->indexType)),
+        LR_StreamingGeometry_BaseVertex(dd->streamingGeometry)
+    ));
     dd->indexStream = NULL;
     dd->indexPtr = 0;
     dd->lastDrawTex = NULL;
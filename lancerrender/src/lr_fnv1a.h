@@ -16,4 +16,19 @@ static inline uint32_t fnv1a_32(const void *input, int len)
     return hash;
 }
 
+#define FNV1_PRIME_64 1099511628211ULL
+#define FNV1_OFFSET_64 14695981039346656037ULL
+static inline uint64_t fnv1a_64(const void *input, int len)
+{
+    const unsigned char *data = input;
+    const unsigned char *end = data + len;
+    uint64_t hash = FNV1_OFFSET_64;
+    for (; data != end; ++data)
+    {
+        hash ^= *data;
+        hash *= FNV1_PRIME_64;
+    }
+    return hash;
+}
+
 #endif
\ No newline at end of file
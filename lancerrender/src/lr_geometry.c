@@ -4,24 +4,20 @@
 #include "lr_errors.h"
 #include "lr_context.h"
 #include "lr_fnv1a.h"
+#include "lr_streamring.h"
 
 typedef struct LR_StreamingGeometry {
     //LR_Geometry members
     LRGTYPE type;
     LR_VertexDeclaration *decl;
     GLuint vao;
+    LRINDEXTYPE indexType;
+    GLuint vertexBuffer;
+    GLuint elementBuffer;
     //private here
-    //vertex
-    int vertSize;
-    int vertStreaming;
-    int stride;
-    GLuint vertex_buffer;
-    void* vertCpubuffer;
-    //element
-    GLuint element_buffer;
-    void *idxcpubuffer;
-    int idxSize;
-    int idxStreaming;
+    LR_StreamRing vertices;
+    LR_StreamRing indices;
+    GLuint element_buffer; //static indices from SetIndices
 } LR_StreamingGeometry;
 
 typedef struct LR_StaticGeometry {
@@ -29,6 +25,9 @@ typedef struct LR_StaticGeometry {
     LRGTYPE type;
     LR_VertexDeclaration *decl;
     GLuint vao;
+    LRINDEXTYPE indexType;
+    GLuint vertexBuffer;
+    GLuint elementBuffer;
     //private here
     GLuint vertex_buffer;
     GLuint element_buffer;
@@ -45,13 +44,21 @@ static GLenum GetElementType(LRELEMENTTYPE type)
             return GL_UNSIGNED_BYTE;
         case LRELEMENTTYPE_USHORT:
             return GL_UNSIGNED_SHORT;
+        case LRELEMENTTYPE_HALF_FLOAT:
+            return GL_HALF_FLOAT;
+        case LRELEMENTTYPE_INT_2_10_10_10_REV:
+            return GL_INT_2_10_10_10_REV;
+        case LRELEMENTTYPE_SHORT:
+            return GL_SHORT;
+        case LRELEMENTTYPE_SBYTE:
+            return GL_BYTE;
         default:
         case LRELEMENTTYPE_FLOAT:
             return GL_FLOAT;
     }
 }
 
-static void ApplyVertexDeclaration(LR_Context *ctx, LR_VertexDeclaration *decl)
+void LR_VertexDeclaration_Apply(LR_Context *ctx, LR_VertexDeclaration *decl)
 {
     for(int i = 0; i < decl->elemCount; i++) {
         LR_VertexElement *e = &decl->elements[i];
@@ -68,64 +75,207 @@ static void ApplyVertexDeclaration(LR_Context *ctx, LR_VertexDeclaration *decl)
 }
 
 
+static uint64_t DeclarationHash(int stride, int elemCount, LR_VertexElement *elements)
+{
+    uint32_t elemHash = fnv1a_32(elements, elemCount * sizeof(LR_VertexElement));
+    uint32_t props = (stride << 16) | (elemCount & 0xFFFF);
+    return ((uint64_t)props << 32) | (uint64_t) elemHash;
+}
+
 LREXPORT LR_VertexDeclaration* LR_VertexDeclaration_Create(LR_Context *ctx, int stride, int elemCount, LR_VertexElement *elements)
 {
     LR_AssertTrue(ctx, elemCount < LR_MAXVERTEXELEMENTS);
+    uint64_t hash = DeclarationHash(stride, elemCount, elements);
+    for(int i = 0; i < ctx->declarations.currIdx; i++) {
+        LR_VertexDeclaration *d = LRVEC_IDX(&ctx->declarations, LR_VertexDeclaration*, i);
+        if(d->hash == hash && d->stride == stride && d->elemCount == elemCount &&
+            !memcmp(d->elements, elements, elemCount * sizeof(LR_VertexElement))) {
+            d->refCount++;
+            return d;
+        }
+    }
     LR_VertexDeclaration *decl = malloc(sizeof(LR_VertexDeclaration));
     decl->stride = stride;
     decl->elemCount = elemCount;
     memcpy(decl->elements, elements, elemCount * sizeof(LR_VertexElement));
-
-    uint32_t elemHash = fnv1a_32(elements, elemCount * sizeof(LR_VertexElement));
-    uint32_t props = (stride << 16) | (elemCount & 0xFFFF);
-    decl->hash = ((uint64_t)props << 32) | (uint64_t) elemHash;
-
+    decl->slotMask = 0;
+    for(int i = 0; i < elemCount; i++) {
+        if(elements[i].type == LRELEMENTTYPE_INT_2_10_10_10_REV) {
+            LR_AssertTrue(ctx, elements[i].elements == 4);
+            if(!ctx->packedVertices)
+                LR_WarningFunc(ctx, "LRELEMENTTYPE_INT_2_10_10_10_REV requires GL_ARB_vertex_type_2_10_10_10_rev");
+        }
+        decl->slotMask |= (1U << elements[i].slot);
+    }
+    decl->hash = hash;
+    decl->refCount = 1;
+    decl->vao = 0;
+    LRVEC_ADD_VAL(ctx, &ctx->declarations, LR_VertexDeclaration*, decl);
     return decl;
 }
-LREXPORT void LR_VertexDeclaration_Free(LR_Context *ctx, LR_VertexDeclaration *decl)
+
+static void DestroyDeclaration(LR_Context *ctx, LR_VertexDeclaration *decl)
 {
+    if(decl->vao) {
+        if(ctx->bound_vao == decl->vao) LR_BindVAO(ctx, 0);
+        glDeleteVertexArrays(1, &decl->vao);
+    }
     free(decl);
 }
 
+LREXPORT void LR_VertexDeclaration_Free(LR_Context *ctx, LR_VertexDeclaration *decl)
+{
+    if(--decl->refCount > 0) return;
+    for(int i = 0; i < ctx->declarations.currIdx; i++) {
+        if(LRVEC_IDX(&ctx->declarations, LR_VertexDeclaration*, i) == decl) {
+            LRVEC_IDX(&ctx->declarations, LR_VertexDeclaration*, i) =
+                LRVEC_IDX(&ctx->declarations, LR_VertexDeclaration*, ctx->declarations.currIdx - 1);
+            ctx->declarations.currIdx--;
+            break;
+        }
+    }
+    DestroyDeclaration(ctx, decl);
+}
+
+void LR_VertexDeclaration_DestroyAll(LR_Context *ctx)
+{
+    for(int i = 0; i < ctx->declarations.currIdx; i++)
+        DestroyDeclaration(ctx, LRVEC_IDX(&ctx->declarations, LR_VertexDeclaration*, i));
+    LRVEC_FREE(ctx, &ctx->declarations, LR_VertexDeclaration*);
+}
+
+/* VAOs */
+static GLuint SharedVAO(LR_Context *ctx, LR_VertexDeclaration *decl)
+{
+    if(decl->vao) return decl->vao;
+    GL_CHECK(ctx, glGenVertexArrays(1, &decl->vao));
+    LR_BindVAO(ctx, decl->vao);
+    for(int i = 0; i < decl->elemCount; i++) {
+        LR_VertexElement *e = &decl->elements[i];
+        GL_CHECK(ctx, glEnableVertexAttribArray(e->slot));
+        GL_CHECK(ctx, glVertexAttribFormat(
+            (GLuint)e->slot,
+            e->elements,
+            GetElementType(e->type),
+            e->normalized,
+            (GLuint)e->offset
+        ));
+        glVertexAttribBinding((GLuint)e->slot, 0);
+    }
+    decl->boundVertexBuffer = 0;
+    decl->boundElementBuffer = 0;
+    return decl->vao;
+}
+
+void LR_Geometry_InitVAO(LR_Context *ctx, LR_Geometry *geo)
+{
+    geo->vertexBuffer = 0;
+    geo->elementBuffer = 0;
+    if(ctx->vertexAttribBinding)
+        geo->vao = SharedVAO(ctx, geo->decl);
+    else
+        GL_CHECK(ctx, glGenVertexArrays(1, &geo->vao));
+}
+
+/* buffer names can be reused once deleted, make the next bind reattach */
+static void InvalidateShared(LR_VertexDeclaration *decl)
+{
+    decl->boundVertexBuffer = ~0U;
+    decl->boundElementBuffer = ~0U;
+}
+
+void LR_Geometry_SetBuffers(LR_Context *ctx, LR_Geometry *geo, GLuint vertexBuffer, GLuint elementBuffer)
+{
+    geo->vertexBuffer = vertexBuffer;
+    geo->elementBuffer = elementBuffer;
+    if(ctx->vertexAttribBinding) {
+        InvalidateShared(geo->decl);
+        return;
+    }
+    LR_BindVAO(ctx, geo->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    LR_VertexDeclaration_Apply(ctx, geo->decl);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+}
+
+void LR_Geometry_Bind(LR_Context *ctx, LR_Geometry *geo)
+{
+    LR_BindVAO(ctx, geo->vao);
+    if(!ctx->vertexAttribBinding) return;
+    LR_VertexDeclaration *decl = geo->decl;
+    if(decl->boundVertexBuffer != geo->vertexBuffer) {
+        GL_CHECK(ctx, glBindVertexBuffer(0, geo->vertexBuffer, 0, decl->stride));
+        decl->boundVertexBuffer = geo->vertexBuffer;
+    }
+    if(decl->boundElementBuffer != geo->elementBuffer) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geo->elementBuffer);
+        decl->boundElementBuffer = geo->elementBuffer;
+    }
+}
+
+void LR_Geometry_ReleaseVAO(LR_Context *ctx, LR_Geometry *geo)
+{
+    if(ctx->vertexAttribBinding) {
+        //the declaration owns the VAO
+        InvalidateShared(geo->decl);
+        return;
+    }
+    if(ctx->bound_vao == geo->vao) LR_BindVAO(ctx, 0);
+    glDeleteVertexArrays(1, &geo->vao);
+}
+
 /* LR_StreamingGeometry */
 LREXPORT LR_Geometry *LR_StreamingGeometry_Create(LR_Context *ctx, LR_VertexDeclaration *decl, int size, int idxSize)
+{
+    return LR_StreamingGeometry_CreateEx(ctx, decl, size, idxSize, LRINDEXTYPE_USHORT);
+}
+
+static void AttachStreamingBuffers(LR_Context *ctx, LR_StreamingGeometry *g)
+{
+    GLuint elements = g->indices.buffer ? g->indices.buffer : g->element_buffer;
+    LR_Geometry_SetBuffers(ctx, (LR_Geometry*)g, g->vertices.buffer, elements);
+}
+
+LREXPORT LR_Geometry *LR_StreamingGeometry_CreateEx(LR_Context *ctx, LR_VertexDeclaration *decl, int size, int idxSize, LRINDEXTYPE indexType)
 {
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)malloc(sizeof(LR_StreamingGeometry));
     g->type = LRGTYPE_STREAMING;
-    g->vertSize = size;
-    g->vertStreaming = 0;
-    g->idxStreaming = 0;
-    g->stride = decl->stride;
     g->decl = decl;
-    GL_CHECK(ctx, glGenVertexArrays(1, &g->vao));
-    GL_CHECK(ctx, glGenBuffers(1, &g->vertex_buffer));
-    LR_BindVAO(ctx, g->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, g->vertex_buffer);
-    GL_CHECK(ctx, glBufferData(GL_ARRAY_BUFFER, size * g->stride, NULL, GL_STREAM_DRAW));
-    ApplyVertexDeclaration(ctx, decl);
-    g->vertCpubuffer = malloc(size * g->stride);
+    g->indexType = indexType;
+    g->element_buffer = 0;
+    LR_Geometry_InitVAO(ctx, (LR_Geometry*)g);
+    LR_StreamRing_Init(ctx, &g->vertices, decl->stride, size, ctx->bufferUpdate);
     if(idxSize > 0) {
-        GL_CHECK(ctx, glGenBuffers(1, &g->element_buffer));
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->element_buffer);
-        GL_CHECK(ctx, glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxSize * 2, NULL, GL_STATIC_DRAW));
-        g->idxcpubuffer = malloc(idxSize * sizeof(uint16_t));
+        LR_StreamRing_Init(ctx, &g->indices, LR_IndexSize(indexType), idxSize, ctx->bufferUpdate);
     } else {
-        g->element_buffer = 0;
+        memset(&g->indices, 0, sizeof(LR_StreamRing));
     }
+    AttachStreamingBuffers(ctx, g);
     return (LR_Geometry*)g;
 }
 
-LREXPORT void LR_StreamingGeometry_SetIndices(LR_Context *ctx, LR_Geometry *geo, uint16_t* indices, int size)
+static void SetIndices(LR_Context *ctx, LR_Geometry *geo, void *indices, int size, LRINDEXTYPE indexType)
 {
     //type check
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
+    LR_AssertTrue(ctx, g->indexType == indexType);
     //set buffer if doesn't exist
-    LR_AssertTrue(ctx, !g->element_buffer);
-    LR_BindVAO(ctx, g->vao);
+    LR_AssertTrue(ctx, !g->element_buffer && !g->indices.buffer);
     GL_CHECK(ctx, glGenBuffers(1, &g->element_buffer));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->element_buffer);
-    GL_CHECK(ctx, glBufferData(GL_ELEMENT_ARRAY_BUFFER, size * sizeof(uint16_t), indices, GL_STATIC_DRAW));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, g->element_buffer);
+    GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, size * LR_IndexSize(indexType), indices, GL_STATIC_DRAW));
+    AttachStreamingBuffers(ctx, g);
+}
+
+LREXPORT void LR_StreamingGeometry_SetIndices(LR_Context *ctx, LR_Geometry *geo, uint16_t* indices, int size)
+{
+    SetIndices(ctx, geo, indices, size, LRINDEXTYPE_USHORT);
+}
+
+LREXPORT void LR_StreamingGeometry_SetIndices32(LR_Context *ctx, LR_Geometry *geo, uint32_t* indices, int size)
+{
+    SetIndices(ctx, geo, indices, size, LRINDEXTYPE_UINT);
 }
 
 LREXPORT void* LR_StreamingGeometry_Begin(LR_Context *ctx, LR_Geometry *geo)
@@ -133,21 +283,34 @@ LREXPORT void* LR_StreamingGeometry_Begin(LR_Context *ctx, LR_Geometry *geo)
     //type check
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
-    //stream
-    LR_AssertTrue(ctx, !g->vertStreaming);
-    g->vertStreaming = 1;
-    return g->vertCpubuffer;
+    GLuint buffer = g->vertices.buffer;
+    void *ptr = LR_StreamRing_Begin(ctx, &g->vertices);
+    //the ring grows when a frame outruns it
+    if(g->vertices.buffer != buffer) AttachStreamingBuffers(ctx, g);
+    return ptr;
 }
 
-LREXPORT uint16_t* LR_StreamingGeometry_BeginIndices(LR_Context *ctx, LR_Geometry *geo)
+static void *BeginIndices(LR_Context *ctx, LR_Geometry *geo, LRINDEXTYPE indexType)
 {
     //type check
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
-    //stream
-    LR_AssertTrue(ctx, !g->idxStreaming);
-    g->idxStreaming = 1;
-    return g->idxcpubuffer;
+    LR_AssertTrue(ctx, g->indices.buffer != 0);
+    LR_AssertTrue(ctx, g->indexType == indexType);
+    GLuint buffer = g->indices.buffer;
+    void *ptr = LR_StreamRing_Begin(ctx, &g->indices);
+    if(g->indices.buffer != buffer) AttachStreamingBuffers(ctx, g);
+    return ptr;
+}
+
+LREXPORT uint16_t* LR_StreamingGeometry_BeginIndices(LR_Context *ctx, LR_Geometry *geo)
+{
+    return (uint16_t*)BeginIndices(ctx, geo, LRINDEXTYPE_USHORT);
+}
+
+LREXPORT uint32_t* LR_StreamingGeometry_BeginIndices32(LR_Context *ctx, LR_Geometry *geo)
+{
+    return (uint32_t*)BeginIndices(ctx, geo, LRINDEXTYPE_UINT);
 }
 
 LREXPORT void* LR_StreamingGeometry_Resize(LR_Context *ctx, LR_Geometry *geo, int newSize)
@@ -156,139 +319,162 @@ LREXPORT void* LR_StreamingGeometry_Resize(LR_Context *ctx, LR_Geometry *geo, in
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
     //resize buffer
-    g->vertSize = newSize;
-    if(g->vertStreaming) {
-        g->vertCpubuffer = realloc(g->vertCpubuffer, newSize * g->stride);
-    } else {
-        free(g->vertCpubuffer);
-        g->vertCpubuffer = malloc(newSize * g->stride);
-    }
-    glDeleteBuffers(1, &g->vertex_buffer);
-    GL_CHECK(ctx, glGenBuffers(1, &g->vertex_buffer));
-    LR_BindVAO(ctx, g->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, g->vertex_buffer);
-    GL_CHECK(ctx, glBufferData(GL_ARRAY_BUFFER, newSize * g->stride, NULL, GL_STREAM_DRAW));
-    ApplyVertexDeclaration(ctx, g->decl);
-    if(g->vertStreaming) return g->vertCpubuffer;
-    else return NULL;
+    void *ptr = LR_StreamRing_Resize(ctx, &g->vertices, newSize);
+    AttachStreamingBuffers(ctx, g);
+    return ptr;
 }
 
-LREXPORT uint16_t* LR_StreamingGeometry_ResizeIndices(LR_Context *ctx, LR_Geometry *geo, int newSize)
+static void *ResizeIndices(LR_Context *ctx, LR_Geometry *geo, int newSize, LRINDEXTYPE indexType)
 {
     //type check
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
+    LR_AssertTrue(ctx, g->indices.buffer != 0);
+    LR_AssertTrue(ctx, g->indexType == indexType);
     //resize buffer
-    g->idxSize = newSize;
-    if(g->idxStreaming) {
-        g->idxcpubuffer = realloc(g->idxcpubuffer, newSize * sizeof(uint16_t));
-    } else {
-        free(g->idxcpubuffer);
-        g->idxcpubuffer = malloc(newSize * sizeof(uint16_t));
-    }
-    glDeleteBuffers(1, &g->element_buffer);
-    GL_CHECK(ctx, glGenBuffers(1, &g->element_buffer));
-    LR_BindVAO(ctx, g->vao);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->vertex_buffer);
-    GL_CHECK(ctx, glBufferData(GL_ELEMENT_ARRAY_BUFFER, newSize * sizeof(uint16_t), NULL, GL_STREAM_DRAW));
-    if(g->idxStreaming) return g->idxcpubuffer;
-    else return NULL;
+    void *ptr = LR_StreamRing_Resize(ctx, &g->indices, newSize);
+    AttachStreamingBuffers(ctx, g);
+    return ptr;
 }
 
+LREXPORT uint16_t* LR_StreamingGeometry_ResizeIndices(LR_Context *ctx, LR_Geometry *geo, int newSize)
+{
+    return (uint16_t*)ResizeIndices(ctx, geo, newSize, LRINDEXTYPE_USHORT);
+}
+
+LREXPORT uint32_t* LR_StreamingGeometry_ResizeIndices32(LR_Context *ctx, LR_Geometry *geo, int newSize)
+{
+    return (uint32_t*)ResizeIndices(ctx, geo, newSize, LRINDEXTYPE_UINT);
+}
 
 LREXPORT void LR_StreamingGeometry_Finish(LR_Context *ctx, LR_Geometry *geo, int count)
 {
-    if(!count) return;
     //type check
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
-    //stream
-    LR_AssertTrue(ctx, g->vertStreaming);
-    g->vertStreaming = 0;
-    glBindBuffer(GL_ARRAY_BUFFER, g->vertex_buffer);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, count * g->stride, g->vertCpubuffer);
+    LR_StreamRing_Finish(ctx, &g->vertices, count);
 }
 
 LREXPORT void LR_StreamingGeometry_FinishIndices(LR_Context *ctx, LR_Geometry *geo, int count)
 {
-    if(!count) return;
     //type check
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
-    //stream
-    LR_AssertTrue(ctx, g->idxStreaming);
-    g->idxStreaming = 0;
-    LR_BindVAO(ctx, g->vao);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->element_buffer);
-    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, count * sizeof(uint16_t), g->idxcpubuffer);
+    LR_StreamRing_Finish(ctx, &g->indices, count);
+}
+
+LREXPORT void LR_StreamingGeometry_SetUpdateMode(LR_Context *ctx, LR_Geometry *geo, LRBUFFERUPDATE mode)
+{
+    //type check
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
+    LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
+    LR_StreamRing_SetMode(ctx, &g->vertices, mode);
+    if(g->indices.buffer) LR_StreamRing_SetMode(ctx, &g->indices, mode);
+    AttachStreamingBuffers(ctx, g);
+}
+
+int LR_StreamingGeometry_BaseVertex(LR_Geometry *geo)
+{
+    return ((LR_StreamingGeometry*)geo)->vertices.base;
+}
+
+int LR_StreamingGeometry_BaseIndex(LR_Geometry *geo)
+{
+    return ((LR_StreamingGeometry*)geo)->indices.base;
 }
 
 LREXPORT void LR_StreamingGeometry_Destroy(LR_Context *ctx, LR_Geometry *geo)
 {
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STREAMING);
     LR_StreamingGeometry *g = (LR_StreamingGeometry*)geo;
-    if(ctx->bound_vao == g->vao) LR_BindVAO(ctx, 0);
-    glDeleteVertexArrays(1, &g->vao);
-    glDeleteBuffers(1, &g->element_buffer);
-    glDeleteBuffers(1, &g->vertex_buffer);
-    free(g->vertCpubuffer);
-    free(g->idxcpubuffer);
+    LR_Geometry_ReleaseVAO(ctx, geo);
+    if(g->element_buffer) glDeleteBuffers(1, &g->element_buffer);
+    LR_StreamRing_Release(ctx, &g->vertices);
+    LR_StreamRing_Release(ctx, &g->indices);
     free(geo);
 }
 
 #define STATIC_INITIAL_CAPACITY (512)
 /* LR_StaticGeometry */
 LREXPORT LR_Geometry *LR_StaticGeometry_Create(LR_Context *ctx, LR_VertexDeclaration *decl)
+{
+    return LR_StaticGeometry_CreateEx(ctx, decl, LRINDEXTYPE_USHORT);
+}
+
+LREXPORT LR_Geometry *LR_StaticGeometry_CreateEx(LR_Context *ctx, LR_VertexDeclaration *decl, LRINDEXTYPE indexType)
 {
     LR_StaticGeometry *g = (LR_StaticGeometry*)malloc(sizeof(LR_StaticGeometry));
     g->type = LRGTYPE_STATIC;
+    g->indexType = indexType;
     g->vertex_size = STATIC_INITIAL_CAPACITY * decl->stride;
-    g->element_size = STATIC_INITIAL_CAPACITY * 2;
+    g->element_size = STATIC_INITIAL_CAPACITY * LR_IndexSize(indexType);
     g->decl = decl;
     g->vertex_offset = 0;
     g->element_offset = 0;
-    GL_CHECK(ctx, glGenVertexArrays(1, &g->vao));
+    LR_Geometry_InitVAO(ctx, (LR_Geometry*)g);
     GL_CHECK(ctx, glGenBuffers(1, &g->vertex_buffer));
     GL_CHECK(ctx, glGenBuffers(1, &g->element_buffer));
-    LR_BindVAO(ctx, g->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, g->vertex_buffer);
-    GL_CHECK(ctx, glBufferData(GL_ARRAY_BUFFER, g->vertex_size, NULL, GL_STATIC_DRAW));
-    ApplyVertexDeclaration(ctx, decl);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->element_buffer);
-    GL_CHECK(ctx, glBufferData(GL_ELEMENT_ARRAY_BUFFER, g->element_size, NULL, GL_STATIC_DRAW));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, g->vertex_buffer);
+    GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, g->vertex_size, NULL, GL_STATIC_DRAW));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, g->element_buffer);
+    GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, g->element_size, NULL, GL_STATIC_DRAW));
+    LR_Geometry_SetBuffers(ctx, (LR_Geometry*)g, g->vertex_buffer, g->element_buffer);
     return (LR_Geometry*)g;
 }
 
-static int EnsureBufferSize(LR_Context *ctx, GLuint *bufferID, int *currentSize, int required)
+/* Grows the buffer so required bytes fit. Capacity at least doubles so a
+ * run of appends costs amortised O(1) copies, and only the used bytes are
+ * carried over. Returns 1 if a new buffer object replaced the old one. */
+static int EnsureBufferSize(LR_Context *ctx, GLuint *bufferID, int *currentSize, int used, int required)
 {
-    if(*currentSize > required) return 0;
-    GLuint newBuffer;
-    int newSize = *currentSize;
-    while(newSize <= required) {
-        newSize *= 2;
+    if(*currentSize >= required) return 0;
+    int newSize = *currentSize * 2;
+    if(newSize < required) newSize = required;
+    if(!used) {
+        /* nothing to keep, respecify in place so the VAO stays valid */
+        glBindBuffer(GL_COPY_WRITE_BUFFER, *bufferID);
+        GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW));
+        *currentSize = newSize;
+        return 0;
     }
+    GLuint newBuffer;
     glGenBuffers(1, &newBuffer);
     glBindBuffer(GL_COPY_READ_BUFFER, *bufferID);
     glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
-    glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
-    GL_CHECK(ctx, glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, *currentSize));
+    GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW));
+    GL_CHECK(ctx, glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used));
     *currentSize = newSize;
     glDeleteBuffers(1, bufferID);
     *bufferID = newBuffer;
     return 1;
 }
 
+static void EnsureVertexSize(LR_Context *ctx, LR_StaticGeometry *g, int required)
+{
+    if(EnsureBufferSize(ctx, &g->vertex_buffer, &g->vertex_size, g->vertex_offset, required))
+        LR_Geometry_SetBuffers(ctx, (LR_Geometry*)g, g->vertex_buffer, g->element_buffer);
+}
+
+static void EnsureElementSize(LR_Context *ctx, LR_StaticGeometry *g, int required)
+{
+    if(EnsureBufferSize(ctx, &g->element_buffer, &g->element_size, g->element_offset, required))
+        LR_Geometry_SetBuffers(ctx, (LR_Geometry*)g, g->vertex_buffer, g->element_buffer);
+}
+
+LREXPORT void LR_StaticGeometry_Reserve(LR_Context *ctx, LR_Geometry *geo, int vertexCount, int indexCount)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_STATIC);
+    LR_StaticGeometry *g = (LR_StaticGeometry*)geo;
+    EnsureVertexSize(ctx, g, g->vertex_offset + vertexCount * g->decl->stride);
+    EnsureElementSize(ctx, g, g->element_offset + indexCount * LR_IndexSize(g->indexType));
+}
+
 LREXPORT void LR_StaticGeometry_UploadVertices(LR_Context *ctx, LR_Geometry *geo, void *data, int size, int *out_baseVertex)
 {
     *out_baseVertex = 0;
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STATIC);
     LR_StaticGeometry *g = (LR_StaticGeometry*)geo;
-    //buffer re-allocated
-    if(EnsureBufferSize(ctx, &g->vertex_buffer, &g->vertex_size, g->vertex_offset + (size * g->decl->stride))) {
-        LR_BindVAO(ctx, g->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, g->vertex_buffer);
-        ApplyVertexDeclaration(ctx, g->decl);
-    }
+    EnsureVertexSize(ctx, g, g->vertex_offset + (size * g->decl->stride));
     glBindBuffer(GL_ARRAY_BUFFER, g->vertex_buffer);
     *out_baseVertex = g->vertex_offset / g->decl->stride;
     GL_CHECK(ctx, glBufferSubData(GL_ARRAY_BUFFER, g->vertex_offset, size * g->decl->stride, data));
@@ -300,12 +486,69 @@ LREXPORT void LR_StaticGeometry_UploadIndices(LR_Context *ctx, LR_Geometry *geo,
     *out_startIndex = 0;
     LR_AssertTrue(ctx, geo->type == LRGTYPE_STATIC);
     LR_StaticGeometry *g = (LR_StaticGeometry*)geo;
-    if(EnsureBufferSize(ctx, &g->element_buffer, &g->element_size, g->element_size + size * 2)) {
-        LR_BindVAO(ctx, g->vao);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g->element_buffer);
+    int indexSize = LR_IndexSize(g->indexType);
+    EnsureElementSize(ctx, g, g->element_offset + size * indexSize);
+    glBindBuffer(GL_ARRAY_BUFFER, g->element_buffer); //don't overwrite element binding
+    *out_startIndex = g->element_offset / indexSize;
+    GL_CHECK(ctx, glBufferSubData(GL_ARRAY_BUFFER, g->element_offset, size * indexSize, data));
+    g->element_offset += size * indexSize;
+}
+
+/* Copies len bytes of each mesh's data into one mapped range of the buffer
+ * bound to GL_ARRAY_BUFFER. The range is past everything already uploaded,
+ * so no draw can be reading it and the map does not need to synchronise. */
+static int UploadMapped(LR_Context *ctx, int offset, int total, LR_StaticMesh *meshes, int count, int vertices, int unit)
+{
+    if(!total) return 1;
+    char *dst = glMapBufferRange(
+        GL_ARRAY_BUFFER,
+        offset,
+        total,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+    );
+    if(!dst) return 0;
+    for(int i = 0; i < count; i++) {
+        int len = (vertices ? meshes[i].vertexCount : meshes[i].indexCount) * unit;
+        if(!len) continue;
+        memcpy(dst, vertices ? meshes[i].vertices : meshes[i].indices, len);
+        dst += len;
     }
+    GL_CHECK(ctx, glUnmapBuffer(GL_ARRAY_BUFFER));
+    return 1;
+}
+
+LREXPORT void LR_StaticGeometry_UploadMeshes(LR_Context *ctx, LR_Geometry *geo, LR_StaticMesh *meshes, int count)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_STATIC);
+    LR_StaticGeometry *g = (LR_StaticGeometry*)geo;
+    int stride = g->decl->stride;
+    int indexSize = LR_IndexSize(g->indexType);
+    int vertexCount = 0;
+    int indexCount = 0;
+    for(int i = 0; i < count; i++) {
+        meshes[i].baseVertex = g->vertex_offset / stride + vertexCount;
+        meshes[i].startIndex = g->element_offset / indexSize + indexCount;
+        vertexCount += meshes[i].vertexCount;
+        indexCount += meshes[i].indexCount;
+    }
+    /* one growth step at most for the whole batch */
+    LR_StaticGeometry_Reserve(ctx, geo, vertexCount, indexCount);
+    glBindBuffer(GL_ARRAY_BUFFER, g->vertex_buffer);
+    if(!UploadMapped(ctx, g->vertex_offset, vertexCount * stride, meshes, count, 1, stride)) {
+        int offset = g->vertex_offset;
+        for(int i = 0; i < count; i++) {
+            glBufferSubData(GL_ARRAY_BUFFER, offset, meshes[i].vertexCount * stride, meshes[i].vertices);
+            offset += meshes[i].vertexCount * stride;
+        }
+    }
+    g->vertex_offset += vertexCount * stride;
     glBindBuffer(GL_ARRAY_BUFFER, g->element_buffer); //don't overwrite element binding
-    *out_startIndex = g->element_offset / 2;
-    GL_CHECK(ctx, glBufferSubData(GL_ARRAY_BUFFER, g->element_offset, size * 2, data));
-    g->element_offset += size * 2;
-}
\ No newline at end of file
+    if(!UploadMapped(ctx, g->element_offset, indexCount * indexSize, meshes, count, 0, indexSize)) {
+        int offset = g->element_offset;
+        for(int i = 0; i < count; i++) {
+            glBufferSubData(GL_ARRAY_BUFFER, offset, meshes[i].indexCount * indexSize, meshes[i].indices);
+            offset += meshes[i].indexCount * indexSize;
+        }
+    }
+    g->element_offset += indexCount * indexSize;
+}
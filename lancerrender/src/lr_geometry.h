@@ -5,7 +5,8 @@
 
 typedef enum LRGTYPE {
     LRGTYPE_STREAMING = 16,
-    LRGTYPE_STATIC = 32
+    LRGTYPE_STATIC = 32,
+    LRGTYPE_HEAP = 64
 } LRGTYPE;
 
 
@@ -17,15 +18,55 @@ struct LR_Geometry {
     LRGTYPE type;
     LR_VertexDeclaration *decl;
     GLuint vao;
+    LRINDEXTYPE indexType;
+    GLuint vertexBuffer; //attached with LR_Geometry_SetBuffers
+    GLuint elementBuffer;
 };
 
+static inline int LR_IndexSize(LRINDEXTYPE type)
+{
+    return type == LRINDEXTYPE_UINT ? 4 : 2;
+}
+
+static inline GLenum LR_IndexGLType(LRINDEXTYPE type)
+{
+    return type == LRINDEXTYPE_UINT ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+}
+
 /* LR_VertexDeclaration */
 #define LR_MAXVERTEXELEMENTS (16)
+/* interned per context, identical layouts are the same object */
 struct LR_VertexDeclaration {
     uint64_t hash;
     int stride;
     int elemCount;
+    uint32_t slotMask; /* 1 << LRELEMENTSLOT for each element */
     LR_VertexElement elements[LR_MAXVERTEXELEMENTS];
+    int refCount;
+    /* with GL_ARB_vertex_attrib_binding, the VAO shared by every geometry
+     * of this layout and the buffers last attached to it */
+    GLuint vao;
+    GLuint boundVertexBuffer;
+    GLuint boundElementBuffer;
 };
 
+/* sets up attribute pointers for the VAO and GL_ARRAY_BUFFER currently bound */
+void LR_VertexDeclaration_Apply(LR_Context *ctx, LR_VertexDeclaration *decl);
+
+/* Geometry VAOs. Without GL_ARB_vertex_attrib_binding each geometry owns
+ * a VAO with its buffers baked in. With it, geometries share their
+ * declaration's VAO and LR_Geometry_Bind swaps the buffers in. */
+void LR_Geometry_InitVAO(LR_Context *ctx, LR_Geometry *geo);
+/* call whenever the geometry's buffer objects change */
+void LR_Geometry_SetBuffers(LR_Context *ctx, LR_Geometry *geo, GLuint vertexBuffer, GLuint elementBuffer);
+void LR_Geometry_Bind(LR_Context *ctx, LR_Geometry *geo);
+void LR_Geometry_ReleaseVAO(LR_Context *ctx, LR_Geometry *geo);
+/* frees every declaration still alive, for LR_Destroy */
+void LR_VertexDeclaration_DestroyAll(LR_Context *ctx);
+
+/* streamed data lives at a moving offset in the ring, these give the
+ * offsets of the last Begin for draw calls */
+int LR_StreamingGeometry_BaseVertex(LR_Geometry *geo);
+int LR_StreamingGeometry_BaseIndex(LR_Geometry *geo);
+
 #endif
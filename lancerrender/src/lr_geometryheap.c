@@ -0,0 +1,428 @@
+#include "lr_geometry.h"
+#include <stdlib.h>
+#include <string.h>
+#include "lr_errors.h"
+#include "lr_context.h"
+#include "lr_vector.h"
+
+/*
+ * Sub-allocating geometry store for one vertex declaration: one VAO, one
+ * vertex buffer and one index buffer shared by every range allocated from it.
+ * Vertex and index space are managed separately by an offset-sorted free list,
+ * ranges are addressed by handle so compaction can move them.
+ */
+
+typedef struct HeapFree {
+    int offset;
+    int size;
+} HeapFree;
+
+/* free list over [0, capacity), in units of vertices or indices */
+typedef struct HeapArena {
+    LR_Vector free;
+    int capacity;
+    int unit;
+    int initialCapacity;
+} HeapArena;
+
+typedef struct HeapRange {
+    int live;
+    int vertexOffset;
+    int vertexCount;
+    int indexOffset;
+    int indexCount;
+} HeapRange;
+
+typedef struct LR_GeometryHeap {
+    //LR_Geometry members
+    LRGTYPE type;
+    LR_VertexDeclaration *decl;
+    GLuint vao;
+    LRINDEXTYPE indexType;
+    GLuint vertexBuffer;
+    GLuint elementBuffer;
+    //private here
+    GLuint vertex_buffer;
+    GLuint element_buffer;
+    HeapArena vertices;
+    HeapArena indices;
+    LR_Vector ranges; /* HeapRange, handle is index + 1 */
+    LR_Vector freeSlots; /* int */
+} LR_GeometryHeap;
+
+#define FREE_AT(arena, i) LRVEC_IDX(&(arena)->free, HeapFree, (i))
+
+static void Arena_Init(HeapArena *arena, int capacity, int unit)
+{
+    LRVEC_INIT(&arena->free, HeapFree, 16);
+    arena->capacity = capacity;
+    arena->initialCapacity = capacity;
+    arena->unit = unit;
+    if(capacity) {
+        arena->free.currIdx = 1;
+        FREE_AT(arena, 0).offset = 0;
+        FREE_AT(arena, 0).size = capacity;
+    }
+}
+
+static void Arena_Insert(LR_Context *ctx, HeapArena *arena, int index, int offset, int size)
+{
+    LRVEC_ADD(ctx, &arena->free, HeapFree, 1);
+    memmove(&FREE_AT(arena, index + 1), &FREE_AT(arena, index), (arena->free.currIdx - 1 - index) * sizeof(HeapFree));
+    FREE_AT(arena, index).offset = offset;
+    FREE_AT(arena, index).size = size;
+}
+
+static void Arena_Remove(HeapArena *arena, int index)
+{
+    memmove(&FREE_AT(arena, index), &FREE_AT(arena, index + 1), (arena->free.currIdx - 1 - index) * sizeof(HeapFree));
+    arena->free.currIdx--;
+}
+
+/* best fit, lowest offset on ties. -1 if nothing fits */
+static int Arena_Alloc(HeapArena *arena, int count)
+{
+    int best = -1;
+    for(int i = 0; i < arena->free.currIdx; i++) {
+        if(FREE_AT(arena, i).size >= count &&
+            (best == -1 || FREE_AT(arena, i).size < FREE_AT(arena, best).size))
+            best = i;
+    }
+    if(best == -1) return -1;
+    int offset = FREE_AT(arena, best).offset;
+    FREE_AT(arena, best).offset += count;
+    FREE_AT(arena, best).size -= count;
+    if(!FREE_AT(arena, best).size) Arena_Remove(arena, best);
+    return offset;
+}
+
+/* returns the range to the list, merging with its neighbours */
+static void Arena_Free(LR_Context *ctx, HeapArena *arena, int offset, int count)
+{
+    if(!count) return;
+    int i = 0;
+    while(i < arena->free.currIdx && FREE_AT(arena, i).offset < offset) i++;
+    int mergePrev = i > 0 && FREE_AT(arena, i - 1).offset + FREE_AT(arena, i - 1).size == offset;
+    int mergeNext = i < arena->free.currIdx && offset + count == FREE_AT(arena, i).offset;
+    if(mergePrev && mergeNext) {
+        FREE_AT(arena, i - 1).size += count + FREE_AT(arena, i).size;
+        Arena_Remove(arena, i);
+    } else if(mergePrev) {
+        FREE_AT(arena, i - 1).size += count;
+    } else if(mergeNext) {
+        FREE_AT(arena, i).offset = offset;
+        FREE_AT(arena, i).size += count;
+    } else {
+        Arena_Insert(ctx, arena, i, offset, count);
+    }
+}
+
+/* lowest free range that can take count units ending at or before limit */
+static int Arena_LowestFit(HeapArena *arena, int count, int limit)
+{
+    for(int i = 0; i < arena->free.currIdx; i++) {
+        HeapFree *f = &FREE_AT(arena, i);
+        if(f->offset + count > limit) return -1;
+        if(f->size >= count) return i;
+    }
+    return -1;
+}
+
+static int Arena_Used(HeapArena *arena)
+{
+    int used = arena->capacity;
+    for(int i = 0; i < arena->free.currIdx; i++) used -= FREE_AT(arena, i).size;
+    return used;
+}
+
+static void BindBuffers(LR_Context *ctx, LR_GeometryHeap *h)
+{
+    LR_Geometry_SetBuffers(ctx, (LR_Geometry*)h, h->vertex_buffer, h->element_buffer);
+}
+
+static GLuint CreateBuffer(LR_Context *ctx, int size)
+{
+    GLuint buffer;
+    GL_CHECK(ctx, glGenBuffers(1, &buffer));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW));
+    return buffer;
+}
+
+/* grows capacity to fit count more units at the end, the old contents are
+ * copied as-is so every offset stays valid */
+static void Arena_Grow(LR_Context *ctx, HeapArena *arena, GLuint *buffer, int count)
+{
+    int newCapacity = arena->capacity ? arena->capacity * 2 : 64;
+    while(newCapacity < arena->capacity + count) newCapacity *= 2;
+    GLuint newBuffer = CreateBuffer(ctx, newCapacity * arena->unit);
+    if(arena->capacity) {
+        glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+        GL_CHECK(ctx, glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, arena->capacity * arena->unit));
+    }
+    glDeleteBuffers(1, buffer);
+    *buffer = newBuffer;
+    Arena_Free(ctx, arena, arena->capacity, newCapacity - arena->capacity);
+    arena->capacity = newCapacity;
+}
+
+static HeapRange *GetRange(LR_Context *ctx, LR_GeometryHeap *h, LR_Handle handle)
+{
+    LR_AssertTrue(ctx, handle >= 1 && (int)handle <= h->ranges.currIdx);
+    HeapRange *r = &LRVEC_IDX(&h->ranges, HeapRange, handle - 1);
+    LR_AssertTrue(ctx, r->live);
+    return r;
+}
+
+LREXPORT LR_Geometry *LR_GeometryHeap_Create(LR_Context *ctx, LR_VertexDeclaration *decl, int vertexCapacity, int indexCapacity)
+{
+    return LR_GeometryHeap_CreateEx(ctx, decl, vertexCapacity, indexCapacity, LRINDEXTYPE_USHORT);
+}
+
+LREXPORT LR_Geometry *LR_GeometryHeap_CreateEx(LR_Context *ctx, LR_VertexDeclaration *decl, int vertexCapacity, int indexCapacity, LRINDEXTYPE indexType)
+{
+    LR_GeometryHeap *h = (LR_GeometryHeap*)malloc(sizeof(LR_GeometryHeap));
+    h->type = LRGTYPE_HEAP;
+    h->decl = decl;
+    h->indexType = indexType;
+    if(vertexCapacity < 64) vertexCapacity = 64;
+    if(indexCapacity < 64) indexCapacity = 64;
+    Arena_Init(&h->vertices, vertexCapacity, decl->stride);
+    Arena_Init(&h->indices, indexCapacity, LR_IndexSize(indexType));
+    LRVEC_INIT(&h->ranges, HeapRange, 64);
+    LRVEC_INIT(&h->freeSlots, int, 16);
+    h->vertex_buffer = CreateBuffer(ctx, vertexCapacity * decl->stride);
+    h->element_buffer = CreateBuffer(ctx, indexCapacity * h->indices.unit);
+    LR_Geometry_InitVAO(ctx, (LR_Geometry*)h);
+    BindBuffers(ctx, h);
+    return (LR_Geometry*)h;
+}
+
+LREXPORT LR_Handle LR_GeometryHeap_Alloc(LR_Context *ctx, LR_Geometry *geo, int vertexCount, int indexCount)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_HEAP);
+    LR_GeometryHeap *h = (LR_GeometryHeap*)geo;
+    int grown = 0;
+    int vertexOffset = vertexCount ? Arena_Alloc(&h->vertices, vertexCount) : 0;
+    if(vertexOffset == -1) {
+        Arena_Grow(ctx, &h->vertices, &h->vertex_buffer, vertexCount);
+        vertexOffset = Arena_Alloc(&h->vertices, vertexCount);
+        grown = 1;
+    }
+    int indexOffset = indexCount ? Arena_Alloc(&h->indices, indexCount) : 0;
+    if(indexOffset == -1) {
+        Arena_Grow(ctx, &h->indices, &h->element_buffer, indexCount);
+        indexOffset = Arena_Alloc(&h->indices, indexCount);
+        grown = 1;
+    }
+    if(grown) BindBuffers(ctx, h);
+    int slot;
+    if(h->freeSlots.currIdx) {
+        slot = LRVEC_IDX(&h->freeSlots, int, --h->freeSlots.currIdx);
+    } else {
+        slot = h->ranges.currIdx;
+        LRVEC_ADD(ctx, &h->ranges, HeapRange, 1);
+    }
+    HeapRange *r = &LRVEC_IDX(&h->ranges, HeapRange, slot);
+    r->live = 1;
+    r->vertexOffset = vertexOffset;
+    r->vertexCount = vertexCount;
+    r->indexOffset = indexOffset;
+    r->indexCount = indexCount;
+    return (LR_Handle)(slot + 1);
+}
+
+LREXPORT void LR_GeometryHeap_Upload(LR_Context *ctx, LR_Geometry *geo, LR_Handle range, void *vertices, void *indices)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_HEAP);
+    LR_GeometryHeap *h = (LR_GeometryHeap*)geo;
+    HeapRange *r = GetRange(ctx, h, range);
+    if(vertices && r->vertexCount) {
+        glBindBuffer(GL_ARRAY_BUFFER, h->vertex_buffer);
+        GL_CHECK(ctx, glBufferSubData(GL_ARRAY_BUFFER, r->vertexOffset * h->vertices.unit, r->vertexCount * h->vertices.unit, vertices));
+    }
+    if(indices && r->indexCount) {
+        glBindBuffer(GL_ARRAY_BUFFER, h->element_buffer); //don't overwrite element binding
+        GL_CHECK(ctx, glBufferSubData(GL_ARRAY_BUFFER, r->indexOffset * h->indices.unit, r->indexCount * h->indices.unit, indices));
+    }
+}
+
+LREXPORT void LR_GeometryHeap_GetRange(LR_Context *ctx, LR_Geometry *geo, LR_Handle range, int *out_baseVertex, int *out_startIndex)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_HEAP);
+    HeapRange *r = GetRange(ctx, (LR_GeometryHeap*)geo, range);
+    *out_baseVertex = r->vertexOffset;
+    *out_startIndex = r->indexOffset;
+}
+
+LREXPORT void LR_GeometryHeap_Free(LR_Context *ctx, LR_Geometry *geo, LR_Handle range)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_HEAP);
+    LR_GeometryHeap *h = (LR_GeometryHeap*)geo;
+    HeapRange *r = GetRange(ctx, h, range);
+    Arena_Free(ctx, &h->vertices, r->vertexOffset, r->vertexCount);
+    Arena_Free(ctx, &h->indices, r->indexOffset, r->indexCount);
+    r->live = 0;
+    LRVEC_ADD_VAL(ctx, &h->freeSlots, int, (int)(range - 1));
+}
+
+/* live ranges of one arena ordered by offset */
+typedef struct MoveEntry {
+    int offset;
+    int slot;
+} MoveEntry;
+
+static int CompareMove(const void *a, const void *b)
+{
+    int x = ((const MoveEntry*)a)->offset;
+    int y = ((const MoveEntry*)b)->offset;
+    return (x > y) - (x < y);
+}
+
+static int *OffsetOf(HeapRange *r, int vertex)
+{
+    return vertex ? &r->vertexOffset : &r->indexOffset;
+}
+
+static int CountOf(HeapRange *r, int vertex)
+{
+    return vertex ? r->vertexCount : r->indexCount;
+}
+
+static MoveEntry *SortedRanges(LR_GeometryHeap *h, int vertex, int *count)
+{
+    MoveEntry *entries = malloc(h->ranges.currIdx * sizeof(MoveEntry) + 1);
+    int n = 0;
+    for(int i = 0; i < h->ranges.currIdx; i++) {
+        HeapRange *r = &LRVEC_IDX(&h->ranges, HeapRange, i);
+        if(!r->live || !CountOf(r, vertex)) continue;
+        entries[n].offset = *OffsetOf(r, vertex);
+        entries[n].slot = i;
+        n++;
+    }
+    qsort(entries, n, sizeof(MoveEntry), CompareMove);
+    *count = n;
+    return entries;
+}
+
+/* Moves the highest ranges into the lowest holes that lie entirely below
+ * them, so source and destination never overlap and the copy can stay in
+ * the same buffer. Returns the number of bytes left in the budget. */
+static int Arena_CompactIncremental(LR_Context *ctx, LR_GeometryHeap *h, int vertex, int budget, int *moved)
+{
+    HeapArena *arena = vertex ? &h->vertices : &h->indices;
+    GLuint buffer = vertex ? h->vertex_buffer : h->element_buffer;
+    int n;
+    MoveEntry *entries = SortedRanges(h, vertex, &n);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    for(int i = n - 1; i >= 0 && budget > 0; i--) {
+        HeapRange *r = &LRVEC_IDX(&h->ranges, HeapRange, entries[i].slot);
+        int count = CountOf(r, vertex);
+        int *offset = OffsetOf(r, vertex);
+        int hole = Arena_LowestFit(arena, count, *offset);
+        if(hole == -1) continue;
+        int dst = FREE_AT(arena, hole).offset;
+        FREE_AT(arena, hole).offset += count;
+        FREE_AT(arena, hole).size -= count;
+        if(!FREE_AT(arena, hole).size) Arena_Remove(arena, hole);
+        GL_CHECK(ctx, glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            *offset * arena->unit, dst * arena->unit, count * arena->unit));
+        Arena_Free(ctx, arena, *offset, count);
+        *offset = dst;
+        budget -= count * arena->unit;
+        *moved = 1;
+    }
+    free(entries);
+    return budget;
+}
+
+/* Copies every live range, tightly packed, into a new buffer sized for the
+ * data in use. Returns the replacement buffer. */
+static GLuint Arena_Repack(LR_Context *ctx, LR_GeometryHeap *h, int vertex)
+{
+    HeapArena *arena = vertex ? &h->vertices : &h->indices;
+    GLuint buffer = vertex ? h->vertex_buffer : h->element_buffer;
+    int used = Arena_Used(arena);
+    int capacity = arena->capacity;
+    /* shrink when mostly empty, keeping room to grow */
+    while(capacity / 2 >= used * 2 && capacity / 2 >= arena->initialCapacity) capacity /= 2;
+    int n;
+    MoveEntry *entries = SortedRanges(h, vertex, &n);
+    GLuint newBuffer = CreateBuffer(ctx, capacity * arena->unit);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    int dst = 0;
+    int runSrc = 0, runDst = 0, runLen = 0;
+    for(int i = 0; i < n; i++) {
+        HeapRange *r = &LRVEC_IDX(&h->ranges, HeapRange, entries[i].slot);
+        int count = CountOf(r, vertex);
+        int *offset = OffsetOf(r, vertex);
+        /* ranges that are already adjacent are copied in one call */
+        if(runLen && runSrc + runLen == *offset) {
+            runLen += count;
+        } else {
+            if(runLen) {
+                GL_CHECK(ctx, glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                    runSrc * arena->unit, runDst * arena->unit, runLen * arena->unit));
+            }
+            runSrc = *offset;
+            runDst = dst;
+            runLen = count;
+        }
+        *offset = dst;
+        dst += count;
+    }
+    if(runLen) {
+        GL_CHECK(ctx, glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            runSrc * arena->unit, runDst * arena->unit, runLen * arena->unit));
+    }
+    free(entries);
+    glDeleteBuffers(1, &buffer);
+    arena->capacity = capacity;
+    arena->free.currIdx = 0;
+    Arena_Free(ctx, arena, dst, capacity - dst);
+    return newBuffer;
+}
+
+LREXPORT int LR_GeometryHeap_Compact(LR_Context *ctx, LR_Geometry *geo, int maxBytes)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_HEAP);
+    LR_GeometryHeap *h = (LR_GeometryHeap*)geo;
+    if(maxBytes <= 0) {
+        h->vertex_buffer = Arena_Repack(ctx, h, 1);
+        h->element_buffer = Arena_Repack(ctx, h, 0);
+        BindBuffers(ctx, h);
+        return 0;
+    }
+    int moved = 0;
+    int budget = Arena_CompactIncremental(ctx, h, 1, maxBytes, &moved);
+    if(budget > 0) budget = Arena_CompactIncremental(ctx, h, 0, budget, &moved);
+    /* out of budget means there may be more to move */
+    return moved && budget <= 0;
+}
+
+LREXPORT void LR_GeometryHeap_GetStats(LR_Context *ctx, LR_Geometry *geo, LR_GeometryHeapStats *stats)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_HEAP);
+    LR_GeometryHeap *h = (LR_GeometryHeap*)geo;
+    stats->vertexCapacity = h->vertices.capacity;
+    stats->vertexUsed = Arena_Used(&h->vertices);
+    stats->vertexFreeRanges = h->vertices.free.currIdx;
+    stats->indexCapacity = h->indices.capacity;
+    stats->indexUsed = Arena_Used(&h->indices);
+    stats->indexFreeRanges = h->indices.free.currIdx;
+}
+
+LREXPORT void LR_GeometryHeap_Destroy(LR_Context *ctx, LR_Geometry *geo)
+{
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_HEAP);
+    LR_GeometryHeap *h = (LR_GeometryHeap*)geo;
+    LR_Geometry_ReleaseVAO(ctx, geo);
+    glDeleteBuffers(1, &h->vertex_buffer);
+    glDeleteBuffers(1, &h->element_buffer);
+    LRVEC_FREE(ctx, &h->vertices.free, HeapFree);
+    LRVEC_FREE(ctx, &h->indices.free, HeapFree);
+    LRVEC_FREE(ctx, &h->ranges, HeapRange);
+    LRVEC_FREE(ctx, &h->freeSlots, int);
+    free(h);
+}
@@ -0,0 +1,80 @@
+#include "lr_context.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Level of detail chains stored as index ranges of one geometry */
+
+struct LR_LODSet {
+    LR_Geometry *geometry;
+    int baseVertex;
+    int levelCount;
+    LR_LODLevel levels[LR_MAX_LODS];
+};
+
+LREXPORT LR_LODSet *LR_LODSet_Create(LR_Context *ctx, LR_Geometry *geometry, int baseVertex, LR_LODLevel *levels, int count)
+{
+    LR_AssertTrue(ctx, count > 0 && count <= LR_MAX_LODS);
+    LR_LODSet *lods = (LR_LODSet*)malloc(sizeof(LR_LODSet));
+    lods->geometry = geometry;
+    lods->baseVertex = baseVertex;
+    lods->levelCount = count;
+    memcpy(lods->levels, levels, count * sizeof(LR_LODLevel));
+    for(int i = 2; i < count; i++) {
+        if(levels[i].maxScreenSize > levels[i - 1].maxScreenSize)
+            LR_WarningFunc(ctx, "LR_LODSet_Create: maxScreenSize should shrink with each level");
+    }
+    return lods;
+}
+
+LREXPORT void LR_LODSet_Destroy(LR_Context *ctx, LR_LODSet *lods)
+{
+    free(lods);
+}
+
+LREXPORT float LR_ScreenSize(LR_Context *ctx, const float *sphere)
+{
+    /* projected diameter in pixels of viewport height. w is the clip space
+     * w of the centre, the view distance for perspective and 1 for ortho */
+    const float *v = ctx->view.m;
+    const float *p = ctx->projection.m;
+    float x = v[0] * sphere[0] + v[4] * sphere[1] + v[8] * sphere[2] + v[12];
+    float y = v[1] * sphere[0] + v[5] * sphere[1] + v[9] * sphere[2] + v[13];
+    float z = v[2] * sphere[0] + v[6] * sphere[1] + v[10] * sphere[2] + v[14];
+    float w = p[3] * x + p[7] * y + p[11] * z + p[15];
+    //camera inside the sphere, only meaningful when w is a distance
+    if(p[11] != 0 && w <= sphere[3]) return -1;
+    float height = (float)ctx->viewports[ctx->viewportSP].height;
+    return sphere[3] * p[5] * height / w;
+}
+
+LREXPORT int LR_LODSet_Select(LR_Context *ctx, LR_LODSet *lods, const float *sphere)
+{
+    float size = LR_ScreenSize(ctx, sphere);
+    if(size < 0) return 0;
+    for(int i = lods->levelCount - 1; i > 0; i--) {
+        if(size <= lods->levels[i].maxScreenSize) return i;
+    }
+    return 0;
+}
+
+LREXPORT int LR_DrawLOD(
+    LR_Context *ctx,
+    LR_Handle material,
+    LR_LODSet *lods,
+    LR_UniformBufferBinding *ubo,
+    LR_Handle transform,
+    LR_Handle lighting,
+    float zval,
+    const float *sphere,
+    int caps
+)
+{
+    int level = LR_LODSet_Select(ctx, lods, sphere);
+    LR_LODLevel *l = &lods->levels[level];
+    if(l->indexCount <= 0) return level;
+    LR_DrawWithCaps(
+        ctx, material, lods->geometry, ubo, transform, lighting, LRPRIMTYPE_TRIANGLELIST, zval,
+        lods->baseVertex, l->startIndex, l->indexCount, caps
+    );
+    return level;
+}
@@ -45,6 +45,8 @@ struct INT_LR_Material_ {
     int hashVsMaterial;
     void *vsMaterialPtr;
     int vsMaterialSize;
+    //feature bits
+    int caps;
 };
 
 LREXPORT LR_Handle LR_Material_Create(LR_Context *ctx)
@@ -178,6 +180,13 @@ LREXPORT void LR_Material_SetVertexParameters(LR_Context *ctx, LR_Handle materia
     memcpy(p->vsMaterialPtr, data, size);
 }
 
+LREXPORT void LR_Material_SetCaps(LR_Context *ctx, LR_Handle material, int caps)
+{
+    LR_Material *mat = FromHandle(ctx,material);
+    HANDLE_CHECK(ctx, mat, "LR_Material_SetCaps");
+    mat->pimpl->caps = caps;
+}
+
 LREXPORT void LR_Material_Free(LR_Context *ctx, LR_Handle material)
 {
     LR_Material *mat = FromHandle(ctx,material);
@@ -217,8 +226,16 @@ void LR_Material_Prepare(LR_Context *ctx, LR_VertexDeclaration* decl, LR_DrawCom
         LR_SetDepthMode(ctx, DEPTHMODE_ALL);
     }
     /* SHADER */
-    LR_Shader *shader = LR_ShaderCollection_GetShader(ctx, mat->pimpl->shaders, decl, 0);
     INT_LR_Material_ *p = mat->pimpl;
+    int caps = p->caps;
+    if(cmd->geometry) {
+        caps |= cmd->g.caps;
+        caps |= LR_ShaderCollection_AutoCaps(ctx, p->shaders, decl, cmd->g.lighting);
+    } else {
+        caps |= LR_ShaderCollection_AutoCaps(ctx, p->shaders, decl, 0);
+    }
+    LR_Shader *shader = LR_ShaderCollection_GetShader(ctx, p->shaders, decl, caps);
+    LR_Shader_Bind(ctx, shader);
     if(p->uniformBlock) {
         LR_Shader_SetUniformBlock(ctx, shader, p->uniformBlockHash, p->uniformBlock);
     }
@@ -254,8 +271,9 @@ void LR_Material_Prepare(LR_Context *ctx, LR_VertexDeclaration* decl, LR_DrawCom
         int ltHash;
         void *ltData;
         int ltSize;
-        if((ltHash = LR_GetLightingInfo(ctx, cmd->g.lighting, &ltSize, &ltData))) {
-            LR_Shader_SetLighting(ctx, shader, ltHash, ltData, ltSize);
+        int ltOffset;
+        if((ltHash = LR_GetLightingInfo(ctx, cmd->g.lighting, &ltSize, &ltData, &ltOffset))) {
+            LR_Shader_SetLighting(ctx, shader, ltHash, ltData, ltSize, ltOffset);
         }
         /* transform */
         LR_Shader_SetTransform(ctx, shader, cmd->g.transform);
@@ -264,6 +282,4 @@ void LR_Material_Prepare(LR_Context *ctx, LR_VertexDeclaration* decl, LR_DrawCom
             LR_BindUniformBuffer(ctx, &cmd->g.uboBinding);
         }
     }
-    /* use program */
-    LR_BindProgram(ctx, shader->programID);
 }
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include <lancerrender_mesh.h>
+#include "lr_context.h"
+#include "lr_geometry.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+struct LR_MeshFile {
+    const char *data;
+    uint64_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+static int MapFile(LR_MeshFile *mf, const char *path)
+{
+#ifdef _WIN32
+    mf->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(mf->file == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(mf->file, &size) || !size.QuadPart) {
+        CloseHandle(mf->file);
+        return 0;
+    }
+    mf->size = (uint64_t)size.QuadPart;
+    mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!mf->mapping) {
+        CloseHandle(mf->file);
+        return 0;
+    }
+    mf->data = (const char*)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!mf->data) {
+        CloseHandle(mf->mapping);
+        CloseHandle(mf->file);
+        return 0;
+    }
+    return 1;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 0;
+    struct stat st;
+    if(fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+    mf->size = (uint64_t)st.st_size;
+    void *ptr = mmap(NULL, (size_t)mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping keeps its own reference to the file
+    close(fd);
+    if(ptr == MAP_FAILED) return 0;
+    madvise(ptr, (size_t)mf->size, MADV_WILLNEED);
+    mf->data = (const char*)ptr;
+    return 1;
+#endif
+}
+
+static void UnmapFile(LR_MeshFile *mf)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(mf->data);
+    CloseHandle(mf->mapping);
+    CloseHandle(mf->file);
+#else
+    munmap((void*)mf->data, (size_t)mf->size);
+#endif
+}
+
+static int CheckRange(const LR_MeshFileHeader *h, uint64_t offset, uint64_t size)
+{
+    return !(offset % LR_MESHFILE_ALIGN) && offset <= h->fileSize && size <= h->fileSize - offset;
+}
+
+/* byte size of an element, 0 if its slot, type or count is unknown */
+static uint32_t ElementSize(const LR_MeshFileElement *e)
+{
+    if(e->slot > LRELEMENTSLOT_COLOR2 || e->elements < 1 || e->elements > 4) return 0;
+    switch(e->type) {
+        case LRELEMENTTYPE_FLOAT:
+            return 4 * e->elements;
+        case LRELEMENTTYPE_USHORT:
+        case LRELEMENTTYPE_SHORT:
+        case LRELEMENTTYPE_HALF_FLOAT:
+            return 2 * e->elements;
+        case LRELEMENTTYPE_BYTE:
+        case LRELEMENTTYPE_SBYTE:
+            return e->elements;
+        case LRELEMENTTYPE_INT_2_10_10_10_REV:
+            return e->elements == 4 ? 4 : 0;
+        default:
+            return 0;
+    }
+}
+
+static LRMeshFileResult Validate(LR_MeshFile *mf)
+{
+    if(mf->size < sizeof(LR_MeshFileHeader)) return LRMeshFileResult_INVALIDORCORRUPT;
+    const LR_MeshFileHeader *h = (const LR_MeshFileHeader*)mf->data;
+    if(h->magic != LR_MESHFILE_MAGIC) return LRMeshFileResult_INVALIDORCORRUPT;
+    if(h->version != LR_MESHFILE_VERSION) return LRMeshFileResult_UNSUPPORTEDVERSION;
+    if(h->fileSize != mf->size ||
+        h->indexType > LRINDEXTYPE_UINT ||
+        !h->vertexStride ||
+        h->elementCount >= LR_MAXVERTEXELEMENTS)
+        return LRMeshFileResult_INVALIDORCORRUPT;
+    for(uint32_t i = 0; i < h->elementCount; i++) {
+        uint32_t size = ElementSize(&h->elements[i]);
+        if(!size || h->elements[i].offset > h->vertexStride || size > h->vertexStride - h->elements[i].offset)
+            return LRMeshFileResult_INVALIDORCORRUPT;
+    }
+    uint64_t indexSize = h->indexType == LRINDEXTYPE_UINT ? 4 : 2;
+    if(!CheckRange(h, h->submeshOffset, (uint64_t)h->submeshCount * sizeof(LR_MeshFileSubmesh)) ||
+        !CheckRange(h, h->vertexOffset, (uint64_t)h->vertexCount * h->vertexStride) ||
+        !CheckRange(h, h->indexOffset, (uint64_t)h->indexCount * indexSize))
+        return LRMeshFileResult_INVALIDORCORRUPT;
+    const LR_MeshFileSubmesh *sub = (const LR_MeshFileSubmesh*)(mf->data + h->submeshOffset);
+    for(uint32_t i = 0; i < h->submeshCount; i++) {
+        if(sub[i].startIndex > h->indexCount || sub[i].indexCount > h->indexCount - sub[i].startIndex)
+            return LRMeshFileResult_INVALIDORCORRUPT;
+    }
+    return LRMeshFileResult_OK;
+}
+
+LREXPORT LR_MeshFile *LR_MeshFile_Open(const char *path, LRMeshFileResult *result)
+{
+    LR_MeshFile *mf = (LR_MeshFile*)malloc(sizeof(LR_MeshFile));
+    if(!MapFile(mf, path)) {
+        free(mf);
+        if(result) *result = LRMeshFileResult_CANNOTOPEN;
+        return NULL;
+    }
+    LRMeshFileResult res = Validate(mf);
+    if(result) *result = res;
+    if(res != LRMeshFileResult_OK) {
+        LR_MeshFile_Close(mf);
+        return NULL;
+    }
+    return mf;
+}
+
+LREXPORT void LR_MeshFile_Close(LR_MeshFile *file)
+{
+    UnmapFile(file);
+    free(file);
+}
+
+LREXPORT const LR_MeshFileHeader *LR_MeshFile_GetHeader(LR_MeshFile *file)
+{
+    return (const LR_MeshFileHeader*)file->data;
+}
+
+LREXPORT const LR_MeshFileSubmesh *LR_MeshFile_GetSubmeshes(LR_MeshFile *file)
+{
+    return (const LR_MeshFileSubmesh*)(file->data + LR_MeshFile_GetHeader(file)->submeshOffset);
+}
+
+LREXPORT const void *LR_MeshFile_GetVertices(LR_MeshFile *file)
+{
+    return file->data + LR_MeshFile_GetHeader(file)->vertexOffset;
+}
+
+LREXPORT const void *LR_MeshFile_GetIndices(LR_MeshFile *file)
+{
+    return file->data + LR_MeshFile_GetHeader(file)->indexOffset;
+}
+
+LREXPORT LR_VertexDeclaration *LR_MeshFile_CreateDeclaration(LR_Context *ctx, LR_MeshFile *file)
+{
+    const LR_MeshFileHeader *h = LR_MeshFile_GetHeader(file);
+    LR_VertexElement elements[LR_MESHFILE_MAXELEMENTS];
+    for(uint32_t i = 0; i < h->elementCount; i++) {
+        elements[i].slot = (LRELEMENTSLOT)h->elements[i].slot;
+        elements[i].type = (LRELEMENTTYPE)h->elements[i].type;
+        elements[i].elements = h->elements[i].elements;
+        elements[i].normalized = h->elements[i].normalized;
+        elements[i].offset = (int)h->elements[i].offset;
+    }
+    return LR_VertexDeclaration_Create(ctx, (int)h->vertexStride, (int)h->elementCount, elements);
+}
+
+LREXPORT void LR_MeshFile_Upload(LR_Context *ctx, LR_MeshFile *file, LR_Geometry *geo, int *out_baseVertex, int *out_startIndex)
+{
+    const LR_MeshFileHeader *h = LR_MeshFile_GetHeader(file);
+    LR_AssertTrue(ctx, geo->type == LRGTYPE_STATIC);
+    LR_AssertTrue(ctx, geo->decl->stride == (int)h->vertexStride);
+    LR_AssertTrue(ctx, geo->indexType == (LRINDEXTYPE)h->indexType);
+    LR_StaticGeometry_Reserve(ctx, geo, h->vertexCount, h->indexCount);
+    LR_StaticGeometry_UploadVertices(ctx, geo, (void*)LR_MeshFile_GetVertices(file), h->vertexCount, out_baseVertex);
+    LR_StaticGeometry_UploadIndices(ctx, geo, (void*)LR_MeshFile_GetIndices(file), h->indexCount, out_startIndex);
+}
@@ -0,0 +1,381 @@
+#include "lr_geometry.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Triangle and vertex reordering for indexed triangle lists. Nothing here
+ * touches GL so it can run offline as well as before an upload. */
+
+#define VCACHE_SIZE (32)
+#define VCACHE_DECAY_POWER (1.5f)
+#define VCACHE_LAST_TRI_SCORE (0.75f)
+#define VCACHE_VALENCE_SCALE (2.0f)
+
+static inline uint32_t GetIndex(const void *indices, LRINDEXTYPE type, int i)
+{
+    return type == LRINDEXTYPE_UINT ? ((const uint32_t*)indices)[i] : ((const uint16_t*)indices)[i];
+}
+
+static inline void SetIndex(void *indices, LRINDEXTYPE type, int i, uint32_t value)
+{
+    if(type == LRINDEXTYPE_UINT) ((uint32_t*)indices)[i] = value;
+    else ((uint16_t*)indices)[i] = (uint16_t)value;
+}
+
+LREXPORT float LR_MeshACMR(const void *indices, LRINDEXTYPE indexType, int indexCount, int vertexCount, int cacheSize)
+{
+    if(indexCount < 3 || cacheSize <= 0) return 0;
+    /* FIFO, like the post-transform caches it models */
+    int *stamp = malloc(vertexCount * sizeof(int));
+    if(!stamp) return 0;
+    for(int i = 0; i < vertexCount; i++) stamp[i] = -cacheSize - 1;
+    int misses = 0;
+    for(int i = 0; i < indexCount; i++) {
+        uint32_t v = GetIndex(indices, indexType, i);
+        if(v >= (uint32_t)vertexCount) continue;
+        if(misses - stamp[v] > cacheSize) {
+            stamp[v] = misses;
+            misses++;
+        }
+    }
+    free(stamp);
+    return (float)misses / (float)(indexCount / 3);
+}
+
+/* Forsyth, "Linear-Speed Vertex Cache Optimisation" */
+static float VertexScore(int cachePos, int remaining)
+{
+    if(remaining == 0) return -1.0f;
+    float score = 0;
+    if(cachePos >= 0 && cachePos < VCACHE_SIZE) {
+        if(cachePos < 3) {
+            score = VCACHE_LAST_TRI_SCORE;
+        } else {
+            float s = 1.0f - (float)(cachePos - 3) / (float)(VCACHE_SIZE - 3);
+            score = s * sqrtf(s); //s ^ VCACHE_DECAY_POWER
+        }
+    }
+    return score + VCACHE_VALENCE_SCALE / sqrtf((float)remaining);
+}
+
+LREXPORT int LR_OptimizeVertexCache(void *indices, LRINDEXTYPE indexType, int indexCount, int vertexCount, LR_VertexCacheStats *stats)
+{
+    if(indexCount % 3) return 0;
+    int triCount = indexCount / 3;
+    if(stats) stats->acmrBefore = LR_MeshACMR(indices, indexType, indexCount, vertexCount, VCACHE_SIZE);
+    uint32_t *idx = malloc(indexCount * sizeof(uint32_t));
+    int *offsets = calloc(vertexCount + 1, sizeof(int));
+    int *remaining = calloc(vertexCount, sizeof(int));
+    int *cachePos = malloc(vertexCount * sizeof(int));
+    float *vertexScore = malloc(vertexCount * sizeof(float));
+    int *triList = malloc(indexCount * sizeof(int));
+    float *triScore = malloc(triCount * sizeof(float));
+    char *added = calloc(triCount, 1);
+    if(!idx || !offsets || !remaining || !cachePos || !vertexScore || !triList || !triScore || !added) {
+        free(idx); free(offsets); free(remaining); free(cachePos);
+        free(vertexScore); free(triList); free(triScore); free(added);
+        return 0;
+    }
+    for(int i = 0; i < indexCount; i++) {
+        idx[i] = GetIndex(indices, indexType, i);
+        if(idx[i] >= (uint32_t)vertexCount) {
+            free(idx); free(offsets); free(remaining); free(cachePos);
+            free(vertexScore); free(triList); free(triScore); free(added);
+            return 0;
+        }
+        remaining[idx[i]]++;
+    }
+    //per-vertex lists of triangles not yet emitted, the first remaining[v] entries are live
+    for(int v = 0; v < vertexCount; v++) offsets[v + 1] = offsets[v] + remaining[v];
+    memset(remaining, 0, vertexCount * sizeof(int));
+    for(int t = 0; t < triCount; t++) {
+        for(int k = 0; k < 3; k++) {
+            uint32_t v = idx[t * 3 + k];
+            triList[offsets[v] + remaining[v]++] = t;
+        }
+    }
+    for(int v = 0; v < vertexCount; v++) {
+        cachePos[v] = -1;
+        vertexScore[v] = VertexScore(-1, remaining[v]);
+    }
+    int best = -1;
+    float bestScore = -1;
+    for(int t = 0; t < triCount; t++) {
+        triScore[t] = vertexScore[idx[t * 3]] + vertexScore[idx[t * 3 + 1]] + vertexScore[idx[t * 3 + 2]];
+        if(triScore[t] > bestScore) {
+            bestScore = triScore[t];
+            best = t;
+        }
+    }
+    int cache[VCACHE_SIZE + 3];
+    int cacheCount = 0;
+    int cursor = 0;
+    for(int out = 0; out < triCount; out++) {
+        if(best < 0) {
+            //dead end, take the next triangle in input order
+            while(added[cursor]) cursor++;
+            best = cursor;
+        }
+        int t = best;
+        added[t] = 1;
+        for(int k = 0; k < 3; k++) {
+            uint32_t v = idx[t * 3 + k];
+            SetIndex(indices, indexType, out * 3 + k, v);
+            int *list = &triList[offsets[v]];
+            for(int j = 0; j < remaining[v]; j++) {
+                if(list[j] == t) {
+                    list[j] = list[--remaining[v]];
+                    break;
+                }
+            }
+        }
+        //move the triangle's vertices to the front of the LRU cache
+        int newCache[VCACHE_SIZE + 3];
+        int newCount = 0;
+        for(int k = 0; k < 3; k++) newCache[newCount++] = (int)idx[t * 3 + k];
+        for(int i = 0; i < cacheCount; i++) {
+            int v = cache[i];
+            if(v != newCache[0] && v != newCache[1] && v != newCache[2])
+                newCache[newCount++] = v;
+        }
+        best = -1;
+        bestScore = -1;
+        for(int i = 0; i < newCount; i++) {
+            int v = newCache[i];
+            cachePos[v] = i < VCACHE_SIZE ? i : -1;
+            float score = VertexScore(cachePos[v], remaining[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for(int j = 0; j < remaining[v]; j++) {
+                int tri = triList[offsets[v] + j];
+                triScore[tri] += delta;
+            }
+        }
+        for(int i = 0; i < newCount && i < VCACHE_SIZE; i++) {
+            int v = newCache[i];
+            for(int j = 0; j < remaining[v]; j++) {
+                int tri = triList[offsets[v] + j];
+                if(triScore[tri] > bestScore) {
+                    bestScore = triScore[tri];
+                    best = tri;
+                }
+            }
+        }
+        cacheCount = newCount < VCACHE_SIZE ? newCount : VCACHE_SIZE;
+        memcpy(cache, newCache, cacheCount * sizeof(int));
+    }
+    free(idx); free(offsets); free(remaining); free(cachePos);
+    free(vertexScore); free(triList); free(triScore); free(added);
+    if(stats) stats->acmrAfter = LR_MeshACMR(indices, indexType, indexCount, vertexCount, VCACHE_SIZE);
+    return 1;
+}
+
+LREXPORT int LR_OptimizeVertexFetch(void *vertices, int stride, int vertexCount, void *indices, LRINDEXTYPE indexType, int indexCount)
+{
+    /* number vertices in order of first use, unreferenced ones go last */
+    int *remap = malloc(vertexCount * sizeof(int));
+    char *tmp = malloc((size_t)vertexCount * stride);
+    if(!remap || !tmp) {
+        free(remap);
+        free(tmp);
+        return 0;
+    }
+    for(int v = 0; v < vertexCount; v++) remap[v] = -1;
+    int next = 0;
+    for(int i = 0; i < indexCount; i++) {
+        uint32_t v = GetIndex(indices, indexType, i);
+        if(v >= (uint32_t)vertexCount) {
+            free(remap);
+            free(tmp);
+            return 0;
+        }
+        if(remap[v] < 0) remap[v] = next++;
+    }
+    for(int v = 0; v < vertexCount; v++) {
+        if(remap[v] < 0) remap[v] = next++;
+    }
+    for(int i = 0; i < indexCount; i++)
+        SetIndex(indices, indexType, i, (uint32_t)remap[GetIndex(indices, indexType, i)]);
+    for(int v = 0; v < vertexCount; v++)
+        memcpy(tmp + (size_t)remap[v] * stride, (char*)vertices + (size_t)v * stride, stride);
+    memcpy(vertices, tmp, (size_t)vertexCount * stride);
+    free(remap);
+    free(tmp);
+    return 1;
+}
+
+/* Vertex clustering simplification (Rossignac & Borrel). Vertices snapped to
+ * the same grid cell collapse onto the one closest to the cell average, so
+ * the output indexes the original vertex data. */
+#define CLUSTER_MAX_GRID (1024)
+
+typedef struct {
+    const char *vertices;
+    int stride;
+    int posOffset;
+    int vertexCount;
+    float min[3];
+    float extent;
+    uint32_t *cells; //per vertex
+    uint32_t *keys; //hash table of cell -> cluster
+    int *values;
+    int tableSize;
+    float *sums; //per cluster, x y z count
+    float *best; //per cluster
+    int *reps; //per cluster
+} ClusterState;
+
+static inline const float *GetPosition(ClusterState *s, int v)
+{
+    return (const float*)(s->vertices + (size_t)v * s->stride + s->posOffset);
+}
+
+static inline uint32_t HashCell(uint32_t c)
+{
+    c ^= c >> 16;
+    c *= 0x7FEB352DU;
+    c ^= c >> 15;
+    c *= 0x846CA68BU;
+    return c ^ (c >> 16);
+}
+
+/* fills reps[] with each vertex's representative for a grid x grid x grid
+ * division of the bounds */
+static void Cluster(ClusterState *s, int grid, int *vertexRep)
+{
+    float scale = s->extent > 0 ? (float)grid / s->extent : 0;
+    memset(s->keys, 0xFF, s->tableSize * sizeof(uint32_t));
+    int clusters = 0;
+    for(int v = 0; v < s->vertexCount; v++) {
+        const float *p = GetPosition(s, v);
+        uint32_t c[3];
+        for(int k = 0; k < 3; k++) {
+            int i = (int)((p[k] - s->min[k]) * scale);
+            c[k] = (uint32_t)(i < 0 ? 0 : (i >= grid ? grid - 1 : i));
+        }
+        uint32_t cell = (c[0] * CLUSTER_MAX_GRID + c[1]) * CLUSTER_MAX_GRID + c[2];
+        uint32_t slot = HashCell(cell) & (s->tableSize - 1);
+        while(s->keys[slot] != 0xFFFFFFFF && s->keys[slot] != cell)
+            slot = (slot + 1) & (s->tableSize - 1);
+        if(s->keys[slot] == 0xFFFFFFFF) {
+            s->keys[slot] = cell;
+            s->values[slot] = clusters;
+            memset(&s->sums[clusters * 4], 0, 4 * sizeof(float));
+            s->reps[clusters] = -1;
+            clusters++;
+        }
+        int cl = s->values[slot];
+        s->cells[v] = (uint32_t)cl;
+        float *sum = &s->sums[cl * 4];
+        sum[0] += p[0];
+        sum[1] += p[1];
+        sum[2] += p[2];
+        sum[3] += 1;
+    }
+    for(int v = 0; v < s->vertexCount; v++) {
+        int cl = (int)s->cells[v];
+        const float *p = GetPosition(s, v);
+        float *sum = &s->sums[cl * 4];
+        float dx = p[0] - sum[0] / sum[3];
+        float dy = p[1] - sum[1] / sum[3];
+        float dz = p[2] - sum[2] / sum[3];
+        float d = dx * dx + dy * dy + dz * dz;
+        if(s->reps[cl] < 0 || d < s->best[cl]) {
+            s->reps[cl] = v;
+            s->best[cl] = d;
+        }
+    }
+    for(int v = 0; v < s->vertexCount; v++)
+        vertexRep[v] = s->reps[s->cells[v]];
+}
+
+/* writes the surviving triangles to out if non-NULL, returns the index count */
+static int CollapseTriangles(const int *vertexRep, const void *indices, LRINDEXTYPE indexType, int indexCount, void *out)
+{
+    int count = 0;
+    for(int i = 0; i + 2 < indexCount; i += 3) {
+        int a = vertexRep[GetIndex(indices, indexType, i)];
+        int b = vertexRep[GetIndex(indices, indexType, i + 1)];
+        int c = vertexRep[GetIndex(indices, indexType, i + 2)];
+        if(a == b || b == c || a == c) continue;
+        if(out) {
+            SetIndex(out, indexType, count, (uint32_t)a);
+            SetIndex(out, indexType, count + 1, (uint32_t)b);
+            SetIndex(out, indexType, count + 2, (uint32_t)c);
+        }
+        count += 3;
+    }
+    return count;
+}
+
+LREXPORT int LR_SimplifyClustered(
+    const void *vertices,
+    int stride,
+    int positionOffset,
+    int vertexCount,
+    const void *indices,
+    LRINDEXTYPE indexType,
+    int indexCount,
+    int targetIndexCount,
+    void *outIndices
+)
+{
+    if(indexCount % 3 || vertexCount <= 0) return 0;
+    for(int i = 0; i < indexCount; i++) {
+        if(GetIndex(indices, indexType, i) >= (uint32_t)vertexCount) return 0;
+    }
+    if(targetIndexCount >= indexCount) {
+        for(int i = 0; i < indexCount; i++)
+            SetIndex(outIndices, indexType, i, GetIndex(indices, indexType, i));
+        return indexCount;
+    }
+    ClusterState s;
+    s.vertices = (const char*)vertices;
+    s.stride = stride;
+    s.posOffset = positionOffset;
+    s.vertexCount = vertexCount;
+    s.tableSize = 1;
+    while(s.tableSize < vertexCount * 2) s.tableSize <<= 1;
+    s.cells = malloc(vertexCount * sizeof(uint32_t));
+    s.keys = malloc(s.tableSize * sizeof(uint32_t));
+    s.values = malloc(s.tableSize * sizeof(int));
+    s.sums = malloc((size_t)vertexCount * 4 * sizeof(float));
+    s.best = malloc(vertexCount * sizeof(float));
+    s.reps = malloc(vertexCount * sizeof(int));
+    int *vertexRep = malloc(vertexCount * sizeof(int));
+    if(!s.cells || !s.keys || !s.values || !s.sums || !s.best || !s.reps || !vertexRep) {
+        free(s.cells); free(s.keys); free(s.values); free(s.sums);
+        free(s.best); free(s.reps); free(vertexRep);
+        return 0;
+    }
+    //cubic cells over the bounding box
+    float max[3];
+    const float *p = GetPosition(&s, 0);
+    for(int k = 0; k < 3; k++) s.min[k] = max[k] = p[k];
+    for(int v = 1; v < vertexCount; v++) {
+        p = GetPosition(&s, v);
+        for(int k = 0; k < 3; k++) {
+            if(p[k] < s.min[k]) s.min[k] = p[k];
+            if(p[k] > max[k]) max[k] = p[k];
+        }
+    }
+    s.extent = 0;
+    for(int k = 0; k < 3; k++) {
+        if(max[k] - s.min[k] > s.extent) s.extent = max[k] - s.min[k];
+    }
+    //largest grid that meets the target, output size grows with resolution
+    int lo = 1, hi = CLUSTER_MAX_GRID;
+    while(lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        Cluster(&s, mid, vertexRep);
+        if(CollapseTriangles(vertexRep, indices, indexType, indexCount, NULL) <= targetIndexCount)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    Cluster(&s, lo, vertexRep);
+    int count = CollapseTriangles(vertexRep, indices, indexType, indexCount, outIndices);
+    free(s.cells); free(s.keys); free(s.values); free(s.sums);
+    free(s.best); free(s.reps); free(vertexRep);
+    return count;
+}
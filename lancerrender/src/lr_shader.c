@@ -2,9 +2,11 @@
 #include "lr_errors.h"
 #include "lr_context.h"
 #include "lr_geometry.h"
+#include "lr_fnv1a.h"
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdio.h>
 
 static void PrintInfoLog(LR_Context *ctx, GLuint obj, void (APIENTRYP infolog)(GLuint, GLsizei, GLsizei*,GLchar*)) 
 {
@@ -24,118 +26,524 @@ static void PrintInfoLog(LR_Context *ctx, GLuint obj, void (APIENTRYP infolog)(G
     if(doprint) LR_WarningFunc(ctx, buffer);
 }
 
-LREXPORT LR_Shader *LR_Shader_Create(LR_Context *ctx, const char *vertex_source, const char *fragment_source)
+/* Returns a compiled stage for the source, compiling it only if no live
+ * stage has the same type and text */
+static LR_ShaderStage *AcquireStage(LR_Context *ctx, GLenum type, const char *source)
 {
-    LR_Shader *sh = (LR_Shader*)malloc(sizeof(LR_Shader));
-    GL_CHECK(ctx, sh->vertexID = glCreateShader(GL_VERTEX_SHADER));
-    GL_CHECK(ctx, sh->fragmentID = glCreateShader(GL_FRAGMENT_SHADER));
-    GL_CHECK(ctx, sh->programID = glCreateProgram());
-    //source
-    GLchar const *vfiles[2];
-    vfiles[0] = ctx->gles ? "#version 300 es\n" : "#version 150\n";
-    vfiles[1] = vertex_source;
-    GLchar const *ffiles[2];
-    ffiles[0] = ctx->gles ? "#version 300 es\n" : "#version 150\n";
-    ffiles[1] = fragment_source;
-    GL_CHECK(ctx, glShaderSource(sh->vertexID, 2, vfiles, NULL));
-    GL_CHECK(ctx, glShaderSource(sh->fragmentID, 2, ffiles, NULL));
-    //compile vertex
-    GL_CHECK(ctx, glCompileShader(sh->vertexID));
+    int length = (int)strlen(source);
+    uint64_t hash = fnv1a_64(source, length);
+    for(int i = 0; i < ctx->shaderStages.currIdx; i++) {
+        LR_ShaderStage *st = LRVEC_IDX(&ctx->shaderStages, LR_ShaderStage*, i);
+        if(st->hash == hash && st->type == type && st->length == length &&
+            !memcmp(st->source, source, length)) {
+            st->refCount++;
+            return st;
+        }
+    }
+    LR_ShaderStage *st = (LR_ShaderStage*)malloc(sizeof(LR_ShaderStage));
+    st->type = type;
+    st->hash = hash;
+    st->length = length;
+    st->source = malloc(length + 1);
+    memcpy(st->source, source, length + 1);
+    st->refCount = 1;
+    st->program = 0;
+    st->owner = NULL;
+    GL_CHECK(ctx, st->id = glCreateShader(type));
+    GLchar const *files[2];
+    files[0] = ctx->gles ? "#version 300 es\n" : "#version 150\n";
+    files[1] = source;
+    GL_CHECK(ctx, glShaderSource(st->id, 2, files, NULL));
+    GL_CHECK(ctx, glCompileShader(st->id));
     GLint status;
-    glGetShaderiv(sh->vertexID, GL_COMPILE_STATUS, &status);
-    PrintInfoLog(ctx, sh->vertexID, glGetShaderInfoLog);
+    glGetShaderiv(st->id, GL_COMPILE_STATUS, &status);
+    PrintInfoLog(ctx, st->id, glGetShaderInfoLog);
     if(!status) {
         LR_CriticalErrorFunc(ctx, "Shader compilation failed.");
     }
-    //compile fragment
-    GL_CHECK(ctx, glCompileShader(sh->fragmentID));
-    glGetShaderiv(sh->fragmentID, GL_COMPILE_STATUS, &status);
-    PrintInfoLog(ctx, sh->fragmentID, glGetShaderInfoLog);
-    if(!status) {
-        LR_CriticalErrorFunc(ctx, "Shader compilation failed.");
+    LRVEC_ADD_VAL(ctx, &ctx->shaderStages, LR_ShaderStage*, st);
+    return st;
+}
+
+static void ReleaseStage(LR_Context *ctx, LR_ShaderStage *st)
+{
+    if(--st->refCount > 0) return;
+    for(int i = 0; i < ctx->shaderStages.currIdx; i++) {
+        if(LRVEC_IDX(&ctx->shaderStages, LR_ShaderStage*, i) == st) {
+            LRVEC_IDX(&ctx->shaderStages, LR_ShaderStage*, i) =
+                LRVEC_IDX(&ctx->shaderStages, LR_ShaderStage*, ctx->shaderStages.currIdx - 1);
+            ctx->shaderStages.currIdx--;
+            break;
+        }
+    }
+    if(st->program) glDeleteProgram(st->program);
+    glDeleteShader(st->id);
+    free(st->source);
+    free(st);
+}
+
+static const struct { int slot; const char *name; } attribNames[] = {
+    { LRELEMENTSLOT_POSITION, "vertex_position" },
+    { LRELEMENTSLOT_NORMAL, "vertex_normal" },
+    { LRELEMENTSLOT_COLOR, "vertex_color" },
+    { LRELEMENTSLOT_COLOR2, "vertex_color2" },
+    { LRELEMENTSLOT_TEXTURE1, "vertex_texture1" },
+    { LRELEMENTSLOT_TEXTURE2, "vertex_texture2" },
+    { LRELEMENTSLOT_DIMENSIONS, "vertex_dimensions" },
+    { LRELEMENTSLOT_RIGHT, "vertex_right" },
+    { LRELEMENTSLOT_UP, "vertex_up" },
+    { LRELEMENTSLOT_BONEWEIGHTS, "vertex_boneweights" },
+    { LRELEMENTSLOT_BONEIDS, "vertex_boneids" },
+};
+#define ATTRIB_COUNT (sizeof(attribNames) / sizeof(attribNames[0]))
+
+static void BindAttribLocations(GLuint program, uint32_t mask)
+{
+    for(int i = 0; i < ATTRIB_COUNT; i++) {
+        if(mask & (1U << attribNames[i].slot))
+            glBindAttribLocation(program, attribNames[i].slot, attribNames[i].name);
     }
-    //attach
-    glAttachShader(sh->programID, sh->vertexID);
-    glAttachShader(sh->programID, sh->fragmentID);
-    //slots
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_POSITION, "vertex_position");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_NORMAL, "vertex_normal");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_COLOR, "vertex_color");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_COLOR2, "vertex_color2");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_TEXTURE1, "vertex_texture1");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_TEXTURE2, "vertex_texture2");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_DIMENSIONS, "vertex_dimensions");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_RIGHT, "vertex_right");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_UP, "vertex_up");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_BONEWEIGHTS, "vertex_boneweights");
-    glBindAttribLocation(sh->programID, LRELEMENTSLOT_BONEIDS, "vertex_boneids");
-    //link
-    GL_CHECK(ctx, glLinkProgram(sh->programID));
-    glGetProgramiv(sh->programID, GL_LINK_STATUS, &status);
-    PrintInfoLog(ctx, sh->programID, glGetProgramInfoLog);
+}
+
+static void LinkProgram(LR_Context *ctx, GLuint program)
+{
+    GLint status;
+    GL_CHECK(ctx, glLinkProgram(program));
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    PrintInfoLog(ctx, program, glGetProgramInfoLog);
     if(!status) {
         LR_CriticalErrorFunc(ctx, "Shader link failed.");
     }
-    //init samplers
+}
+
+/* One separable program per stage, shared by every pipeline using it */
+static GLuint StageProgram(LR_Context *ctx, LR_ShaderStage *st)
+{
+    if(st->program) return st->program;
+    GL_CHECK(ctx, st->program = glCreateProgram());
+    glProgramParameteri(st->program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    glAttachShader(st->program, st->id);
+    if(st->type == GL_VERTEX_SHADER) BindAttribLocations(st->program, 0xFFFFFFFF);
+    LinkProgram(ctx, st->program);
+    glDetachShader(st->program, st->id);
+    return st->program;
+}
+
+static int ShaderPrograms(LR_Shader *sh, GLuint *programs)
+{
+    if(sh->pipeline) {
+        programs[0] = sh->vertex->program;
+        programs[1] = sh->fragment->program;
+        return 2;
+    }
+    programs[0] = sh->programID;
+    return 1;
+}
+
+static LR_Uniform NoUniform(void)
+{
+    LR_Uniform u = { -1, { 0, 0 }, { -1, -1 } };
+    return u;
+}
+
+static LR_Uniform FindUniform(LR_Shader *sh, const char *name)
+{
+    GLuint programs[2];
+    int count = ShaderPrograms(sh, programs);
+    LR_Uniform u = NoUniform();
+    for(int i = 0; i < count; i++) {
+        u.programs[i] = programs[i];
+        u.locations[i] = glGetUniformLocation(programs[i], name);
+        if(u.location == -1) u.location = u.locations[i];
+    }
+    return u;
+}
+
+static void SetUniform1i(LR_Context *ctx, LR_Uniform *u, GLint value)
+{
+    for(int i = 0; i < 2; i++) {
+        if(u->locations[i] == -1) continue;
+        if(ctx->separateShaders) {
+            glProgramUniform1i(u->programs[i], u->locations[i], value);
+        } else {
+            LR_BindProgram(ctx, u->programs[i]);
+            glUniform1i(u->locations[i], value);
+        }
+    }
+}
+
+static void SetUniform4fv(LR_Context *ctx, LR_Uniform *u, int count, const GLfloat *value)
+{
+    for(int i = 0; i < 2; i++) {
+        if(u->locations[i] == -1) continue;
+        if(ctx->separateShaders) {
+            glProgramUniform4fv(u->programs[i], u->locations[i], count, value);
+        } else {
+            LR_BindProgram(ctx, u->programs[i]);
+            glUniform4fv(u->locations[i], count, value);
+        }
+    }
+}
+
+static void SetUniformMatrix4fv(LR_Context *ctx, LR_Uniform *u, const GLfloat *value)
+{
+    for(int i = 0; i < 2; i++) {
+        if(u->locations[i] == -1) continue;
+        if(ctx->separateShaders) {
+            glProgramUniformMatrix4fv(u->programs[i], u->locations[i], 1, GL_FALSE, value);
+        } else {
+            LR_BindProgram(ctx, u->programs[i]);
+            glUniformMatrix4fv(u->locations[i], 1, GL_FALSE, value);
+        }
+    }
+}
+
+static void ResetUniformCache(LR_Shader *sh)
+{
     for(int i = 0; i < LR_MAX_SAMPLERS; i++) {
-        sh->samplerLocations[i] = -2;
         sh->samplerHashes[i] = 0;
     }
+    sh->currentUniformBlock = 0;
+    sh->hash_fsMaterial = 0;
+    sh->hash_vsMaterial = 0;
+    sh->cameraVersion = -1;
+    sh->hash_Lighting = 0;
+    sh->size_Lighting = 0;
+    sh->currentTransform = UINT64_MAX;
+    for(int i = 0; i < sh->reflSamplerCount; i++) {
+        sh->reflSamplers[i].unit = -1;
+    }
+}
+
+static const struct { uint32_t bit; const char *name; } reflNames[] = {
+    { LR_REFL_VIEW, "View" },
+    { LR_REFL_PROJECTION, "Projection" },
+    { LR_REFL_VIEWPROJECTION, "ViewProjection" },
+    { LR_REFL_WORLD, "World" },
+    { LR_REFL_NORMAL, "Normal" },
+    { LR_REFL_VSMATERIAL, "vs_Material" },
+    { LR_REFL_FSMATERIAL, "fs_Material" },
+    { LR_REFL_LIGHTING, "Lighting" },
+    { LR_REFL_TRANSFORMINDEX, "TransformIndex" },
+};
+static const struct { uint32_t bit; const char *name; } reflBlockNames[] = {
+    { LR_REFL_CAMERA_BLOCK, "Camera" },
+    { LR_REFL_TRANSFORMS_BLOCK, "Transforms" },
+    { LR_REFL_LIGHTING_BLOCK, "Lighting" },
+};
+
+/* Records are lines of "a name", "u name [size]", "b name size", "s name unit".
+ * Names the runtime does not look up are ignored. */
+int LR_ShaderReflection_Parse(const char *text, LR_ShaderReflection *refl)
+{
+    memset(refl, 0, sizeof(LR_ShaderReflection));
+    const char *line = text;
+    int records = 0;
+    while(*line) {
+        const char *eol = strchr(line, '\n');
+        if(!eol) eol = line + strlen(line);
+        char kind;
+        char name[LR_MAX_REFL_NAME];
+        int value = 0;
+        char buf[LR_MAX_REFL_NAME + 32];
+        int len = (int)(eol - line);
+        if(len >= (int)sizeof(buf)) return 0;
+        memcpy(buf, line, len);
+        buf[len] = 0;
+        line = *eol ? eol + 1 : eol;
+        if(!len) continue;
+        int n = sscanf(buf, "%c %63s %d", &kind, name, &value);
+        if(n < 2) return 0;
+        records++;
+        switch(kind) {
+        case 'a':
+            for(int i = 0; i < ATTRIB_COUNT; i++) {
+                if(!strcmp(name, attribNames[i].name)) refl->attributes |= (1U << attribNames[i].slot);
+            }
+            break;
+        case 'u':
+            for(int i = 0; i < sizeof(reflNames) / sizeof(reflNames[0]); i++) {
+                if(!strcmp(name, reflNames[i].name)) refl->uniforms |= reflNames[i].bit;
+            }
+            if(!strcmp(name, "vs_Material")) refl->vsMaterialSize = value;
+            if(!strcmp(name, "fs_Material")) refl->fsMaterialSize = value;
+            break;
+        case 'b':
+            for(int i = 0; i < sizeof(reflBlockNames) / sizeof(reflBlockNames[0]); i++) {
+                if(!strcmp(name, reflBlockNames[i].name)) refl->uniforms |= reflBlockNames[i].bit;
+            }
+            break;
+        case 's':
+            if(n < 3 || refl->nsamplers >= LR_MAX_SAMPLERS) return 0;
+            strcpy(refl->samplerNames[refl->nsamplers], name);
+            refl->samplerUnits[refl->nsamplers] = value;
+            refl->nsamplers++;
+            break;
+        default:
+            return 0;
+        }
+    }
+    /* a variant always has at least one attribute, an empty record is
+     * missing data rather than a shader using nothing */
+    return records > 0;
+}
+
+static LR_Uniform KnownUniform(LR_Shader *sh, const LR_ShaderReflection *refl, uint32_t bit, const char *name)
+{
+    if(refl && !(refl->uniforms & bit)) return NoUniform();
+    return FindUniform(sh, name);
+}
+
+static GLuint KnownBlock(GLuint program, const LR_ShaderReflection *refl, uint32_t bit, const char *name)
+{
+    if(refl && !(refl->uniforms & bit)) return GL_INVALID_INDEX;
+    return glGetUniformBlockIndex(program, name);
+}
+
+LREXPORT LR_Shader *LR_Shader_Create(LR_Context *ctx, const char *vertex_source, const char *fragment_source)
+{
+    return LR_Shader_CreateReflected(ctx, vertex_source, fragment_source, NULL);
+}
+
+LR_Shader *LR_Shader_CreateReflected(LR_Context *ctx, const char *vertex_source, const char *fragment_source, const LR_ShaderReflection *refl)
+{
+    LR_ShaderStage *vertex = AcquireStage(ctx, GL_VERTEX_SHADER, vertex_source);
+    LR_ShaderStage *fragment = AcquireStage(ctx, GL_FRAGMENT_SHADER, fragment_source);
+    /* identical stages always link to an identical program */
+    for(int i = 0; i < ctx->shaders.currIdx; i++) {
+        LR_Shader *existing = LRVEC_IDX(&ctx->shaders, LR_Shader*, i);
+        if(existing->vertex == vertex && existing->fragment == fragment &&
+            (existing->pipeline != 0) == ctx->useSeparateShaders) {
+            ReleaseStage(ctx, vertex);
+            ReleaseStage(ctx, fragment);
+            existing->refCount++;
+            return existing;
+        }
+    }
+    LR_Shader *sh = (LR_Shader*)malloc(sizeof(LR_Shader));
+    sh->vertex = vertex;
+    sh->fragment = fragment;
+    sh->refCount = 1;
+    sh->programID = 0;
+    sh->pipeline = 0;
+    if(ctx->useSeparateShaders) {
+        /* no link step, the stages are combined at draw time */
+        GLuint vprog = StageProgram(ctx, vertex);
+        GLuint fprog = StageProgram(ctx, fragment);
+        GL_CHECK(ctx, glGenProgramPipelines(1, &sh->pipeline));
+        glUseProgramStages(sh->pipeline, GL_VERTEX_SHADER_BIT, vprog);
+        glUseProgramStages(sh->pipeline, GL_FRAGMENT_SHADER_BIT, fprog);
+    } else {
+        GL_CHECK(ctx, sh->programID = glCreateProgram());
+        glAttachShader(sh->programID, vertex->id);
+        glAttachShader(sh->programID, fragment->id);
+        BindAttribLocations(sh->programID, refl ? refl->attributes : 0xFFFFFFFF);
+        LinkProgram(ctx, sh->programID);
+        /* stages stay compiled in the cache, the program no longer needs them */
+        glDetachShader(sh->programID, vertex->id);
+        glDetachShader(sh->programID, fragment->id);
+    }
+    //init samplers
+    for(int i = 0; i < LR_MAX_SAMPLERS; i++) {
+        sh->samplerLocations[i].location = -2;
+    }
+    sh->reflSamplerCount = 0;
+    ResetUniformCache(sh);
     //matrix uniforms
-    sh->posView = glGetUniformLocation(sh->programID, "View");
-    sh->posProjection = glGetUniformLocation(sh->programID, "Projection");
-    sh->posViewProjection = glGetUniformLocation(sh->programID, "ViewProjection");
-    sh->posWorld = glGetUniformLocation(sh->programID, "World");
-    sh->posNormal = glGetUniformLocation(sh->programID, "Normal");
+    sh->posView = KnownUniform(sh, refl, LR_REFL_VIEW, "View");
+    sh->posProjection = KnownUniform(sh, refl, LR_REFL_PROJECTION, "Projection");
+    sh->posViewProjection = KnownUniform(sh, refl, LR_REFL_VIEWPROJECTION, "ViewProjection");
+    sh->posWorld = KnownUniform(sh, refl, LR_REFL_WORLD, "World");
+    sh->posNormal = KnownUniform(sh, refl, LR_REFL_NORMAL, "Normal");
     //material uniforms
-    sh->pos_vsMaterial = glGetUniformLocation(sh->programID, "vs_Material");
-    sh->pos_fsMaterial = glGetUniformLocation(sh->programID, "fs_Material");
-    sh->pos_Lighting = glGetUniformLocation(sh->programID, "Lighting");
+    sh->pos_vsMaterial = KnownUniform(sh, refl, LR_REFL_VSMATERIAL, "vs_Material");
+    sh->pos_fsMaterial = KnownUniform(sh, refl, LR_REFL_FSMATERIAL, "fs_Material");
+    sh->pos_Lighting = KnownUniform(sh, refl, LR_REFL_LIGHTING, "Lighting");
+    sh->reflected = refl != NULL;
+    sh->vsMaterialSize = refl ? refl->vsMaterialSize : 0;
+    sh->fsMaterialSize = refl ? refl->fsMaterialSize : 0;
+    //samplers are given their suggested unit once, materials using the
+    //same unit then never upload them
+    if(refl) {
+        for(int i = 0; i < refl->nsamplers; i++) {
+            LR_ReflectedSampler *rs = &sh->reflSamplers[sh->reflSamplerCount++];
+            rs->hash = fnv1a_32(refl->samplerNames[i], strlen(refl->samplerNames[i]));
+            rs->location = FindUniform(sh, refl->samplerNames[i]);
+            rs->unit = refl->samplerUnits[i];
+            if(rs->location.location != -1) SetUniform1i(ctx, &rs->location, rs->unit);
+        }
+    }
+    //per-frame blocks, bound to fixed points
+    GLuint programs[2];
+    int programCount = ShaderPrograms(sh, programs);
+    int hasTransforms = 0;
+    sh->hasCameraBlock = 0;
+    sh->lightingBlockSize = 0;
+    for(int i = 0; i < programCount; i++) {
+        GLuint blockIndex = KnownBlock(programs[i], refl, LR_REFL_CAMERA_BLOCK, "Camera");
+        if(blockIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programs[i], blockIndex, LR_UBO_BINDING_CAMERA);
+            sh->hasCameraBlock = 1;
+        }
+        blockIndex = KnownBlock(programs[i], refl, LR_REFL_TRANSFORMS_BLOCK, "Transforms");
+        if(blockIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programs[i], blockIndex, LR_UBO_BINDING_TRANSFORMS);
+            hasTransforms = 1;
+        }
+        blockIndex = KnownBlock(programs[i], refl, LR_REFL_LIGHTING_BLOCK, "Lighting");
+        if(blockIndex != GL_INVALID_INDEX) {
+            GLint size;
+            glUniformBlockBinding(programs[i], blockIndex, LR_UBO_BINDING_LIGHTING);
+            glGetActiveUniformBlockiv(programs[i], blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+            if(size > sh->lightingBlockSize) sh->lightingBlockSize = size;
+        }
+    }
+    sh->posTransformIndex = NoUniform();
+    if(hasTransforms) {
+        sh->posTransformIndex = KnownUniform(sh, refl, LR_REFL_TRANSFORMINDEX, "TransformIndex");
+    }
+    LRVEC_ADD_VAL(ctx, &ctx->shaders, LR_Shader*, sh);
     return sh;
 }
 
+void LR_Shader_Bind(LR_Context *ctx, LR_Shader *shader)
+{
+    if(!shader->pipeline) {
+        LR_BindProgram(ctx, shader->programID);
+        return;
+    }
+    /* stage programs are shared, if another pipeline set their uniforms
+     * since this one was last used the cached values are stale */
+    if(shader->vertex->owner != shader || shader->fragment->owner != shader) {
+        shader->vertex->owner = shader;
+        shader->fragment->owner = shader;
+        ResetUniformCache(shader);
+    }
+    LR_BindProgram(ctx, 0);
+    LR_BindPipeline(ctx, shader->pipeline);
+}
+
+static void FreeShader(LR_Context *ctx, LR_Shader *sh)
+{
+    if(sh->pipeline) {
+        if(ctx->bound_pipeline == sh->pipeline) LR_BindPipeline(ctx, 0);
+        if(sh->vertex->owner == sh) sh->vertex->owner = NULL;
+        if(sh->fragment->owner == sh) sh->fragment->owner = NULL;
+        glDeleteProgramPipelines(1, &sh->pipeline);
+    } else {
+        if(ctx->bound_program == sh->programID) LR_BindProgram(ctx, 0);
+        glDeleteProgram(sh->programID);
+    }
+    ReleaseStage(ctx, sh->vertex);
+    ReleaseStage(ctx, sh->fragment);
+    free(sh);
+}
+
+LREXPORT void LR_Shader_Destroy(LR_Context *ctx, LR_Shader *shader)
+{
+    if(--shader->refCount > 0) return;
+    for(int i = 0; i < ctx->shaders.currIdx; i++) {
+        if(LRVEC_IDX(&ctx->shaders, LR_Shader*, i) == shader) {
+            LRVEC_IDX(&ctx->shaders, LR_Shader*, i) =
+                LRVEC_IDX(&ctx->shaders, LR_Shader*, ctx->shaders.currIdx - 1);
+            ctx->shaders.currIdx--;
+            break;
+        }
+    }
+    FreeShader(ctx, shader);
+}
+
+void LR_Shader_DestroyCache(LR_Context *ctx)
+{
+    for(int i = 0; i < ctx->shaders.currIdx; i++) {
+        FreeShader(ctx, LRVEC_IDX(&ctx->shaders, LR_Shader*, i));
+    }
+    LR_AssertTrue(ctx, ctx->shaderStages.currIdx == 0);
+    LRVEC_FREE(ctx, &ctx->shaders, LR_Shader*);
+    LRVEC_FREE(ctx, &ctx->shaderStages, LR_ShaderStage*);
+}
+
 void LR_Shader_ResetSamplers(LR_Context *ctx, LR_Shader *shader)
 {
     for(int i = 0; i < LR_MAX_SAMPLERS; i++) {
-        shader->samplerLocations[i] = -2;
+        shader->samplerLocations[i].location = -2;
         shader->samplerHashes[i] = 0;
     }
 }
 
 void LR_Shader_SetSamplerIndex(LR_Context *ctx, LR_Shader *shader, const char *sampler, int hash, int index)
 {
+    if(shader->samplerHashes[(index - 1)] != hash && shader->reflected) {
+        shader->samplerHashes[(index - 1)] = hash;
+        for(int i = 0; i < shader->reflSamplerCount; i++) {
+            LR_ReflectedSampler *rs = &shader->reflSamplers[i];
+            if(rs->hash != hash) continue;
+            if(rs->location.location != -1 && rs->unit != index) {
+                rs->unit = index;
+                SetUniform1i(ctx, &rs->location, index);
+            }
+            return;
+        }
+        /* the variant never samples it */
+        return;
+    }
     if(shader->samplerHashes[(index - 1)] != hash) {
-        GLint loc = shader->samplerLocations[(index - 1)];
-        if(loc == -2) {
-            loc = glGetUniformLocation(shader->programID, sampler);
-            shader->samplerLocations[(index - 1)] =  loc;
+        LR_Uniform *loc = &shader->samplerLocations[(index - 1)];
+        if(loc->location == -2) {
+            *loc = FindUniform(shader, sampler);
         }
         shader->samplerHashes[(index - 1)] = hash;
-        if(loc != -1) {
-            LR_BindProgram(ctx, shader->programID);
-            GL_CHECK(ctx, glUniform1i(loc, index));
+        if(loc->location != -1) {
+            SetUniform1i(ctx, loc, index);
         }
     }
 }
 
 void LR_Shader_SetCamera(LR_Context *ctx, LR_Shader *shader)
 {
+    if(shader->hasCameraBlock) {
+        /* shared by all programs, no-op unless the camera changed */
+        LR_UniformRing_Bind(ctx, &ctx->uniformRing, LR_UBO_BINDING_CAMERA, ctx->cameraOffset, LR_CAMERA_BLOCK_SIZE);
+    }
     if(shader->cameraVersion == ctx->vp_version) return;
     shader->cameraVersion = ctx->vp_version;
     /* Set Uniforms*/
-    LR_BindProgram(ctx, shader->programID);
-    if(shader->posViewProjection != -1) glUniformMatrix4fv(shader->posViewProjection, 1, GL_FALSE, (GLfloat*)&ctx->viewprojection);
-    if(shader->posProjection != -1) glUniformMatrix4fv(shader->posProjection, 1, GL_FALSE, (GLfloat*)&ctx->projection);
-    if(shader->posView != -1) glUniformMatrix4fv(shader->posView, 1, GL_FALSE, (GLfloat*)&ctx->view);
+    if(shader->posViewProjection.location != -1) SetUniformMatrix4fv(ctx, &shader->posViewProjection, (GLfloat*)&ctx->viewprojection);
+    if(shader->posProjection.location != -1) SetUniformMatrix4fv(ctx, &shader->posProjection, (GLfloat*)&ctx->projection);
+    if(shader->posView.location != -1) SetUniformMatrix4fv(ctx, &shader->posView, (GLfloat*)&ctx->view);
+}
+
+/* Picks the Transforms block window containing the transform, keeping the
+ * current one where possible so consecutive draws only change TransformIndex */
+static int TransformWindowIndex(LR_Context *ctx, LR_Handle transform)
+{
+    int offset = (int)(transform * sizeof(LR_Matrix4x4));
+    int end = offset + 2 * sizeof(LR_Matrix4x4);
+    if(ctx->transformWindow < 0 ||
+        offset < ctx->transformWindow ||
+        end > ctx->transformWindow + (int)LR_TRANSFORM_BLOCK_SIZE) {
+        ctx->transformWindow = (offset / ctx->uboOffsetAlign) * ctx->uboOffsetAlign;
+    }
+    LR_UniformRing_Bind(ctx, &ctx->transformRing, LR_UBO_BINDING_TRANSFORMS, ctx->transformWindow, LR_TRANSFORM_BLOCK_SIZE);
+    return (offset - ctx->transformWindow) / sizeof(LR_Matrix4x4);
 }
 
 void LR_Shader_SetTransform(LR_Context *ctx, LR_Shader *shader, LR_Handle transform)
 {
+    if(shader->posTransformIndex.location != -1) {
+        int index = TransformWindowIndex(ctx, transform);
+        uint64_t id = ((uint64_t)ctx->currentFrame << 32) | (uint64_t)index;
+        if(shader->currentTransform != id) {
+            shader->currentTransform = id;
+            SetUniform1i(ctx, &shader->posTransformIndex, index);
+        }
+        return;
+    }
     uint64_t id = ((uint64_t)ctx->currentFrame << 32) | (uint64_t)transform;
     if(shader->currentTransform != id) {
         shader->currentTransform = id;
-        if(shader->posWorld != -1) glUniformMatrix4fv(shader->posWorld, 1, GL_FALSE, (GLfloat*)&LRVEC_IDX(&ctx->transforms, LR_Matrix4x4, transform));
-        if(shader->posNormal != -1) glUniformMatrix4fv(shader->posNormal, 1, GL_FALSE, (GLfloat*)&LRVEC_IDX(&ctx->transforms, LR_Matrix4x4, transform + 1));
+        if(shader->posWorld.location != -1) SetUniformMatrix4fv(ctx, &shader->posWorld, (GLfloat*)LR_TransformPtr(ctx, transform));
+        if(shader->posNormal.location != -1) SetUniformMatrix4fv(ctx, &shader->posNormal, (GLfloat*)LR_TransformPtr(ctx, transform + 1));
     }
 }
 
@@ -197,49 +605,86 @@ LR_Shader* LR_ShaderCollection_GetShader(LR_Context *ctx, LR_ShaderCollection *c
     if(!vpair) {
         vpair = &col->defPair;
     }
-    /* Find caps entry */
+    if(!caps) return vpair->defShader;
+    /* Find caps entry, falling back to the variant supporting the most requested features */
+    LR_Shader *best = vpair->defShader;
+    int bestBits = 0;
     for(int i = 0; i < vpair->capPairsCount; i++) {
-        if(vpair->capPairs[i].capsBits == caps)
+        int bits = vpair->capPairs[i].capsBits;
+        if(bits == caps)
             return vpair->capPairs[i].shader;
+        if((bits & ~caps) == 0) {
+            int count = 0;
+            for(int b = bits; b; b &= (b - 1)) count++;
+            if(count > bestBits) {
+                bestBits = count;
+                best = vpair->capPairs[i].shader;
+            }
+        }
     }
-    return vpair->defShader;
+    return best;
+}
+
+LREXPORT void LR_ShaderCollection_SetAutoCap(LR_Context *ctx, LR_ShaderCollection *col, LRAUTOCAP cap, int capsBits)
+{
+    LR_AssertTrue(ctx, cap >= 0 && cap < LRAUTOCAP_COUNT);
+    col->autoCaps[cap] = capsBits;
+}
+
+int LR_ShaderCollection_AutoCaps(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, LR_Handle lighting)
+{
+    int caps = 0;
+    if(lighting) caps |= col->autoCaps[LRAUTOCAP_LIGHTING];
+    if(decl->slotMask & (1U << LRELEMENTSLOT_COLOR)) caps |= col->autoCaps[LRAUTOCAP_VERTEXCOLOR];
+    if(decl->slotMask & (1U << LRELEMENTSLOT_NORMAL)) caps |= col->autoCaps[LRAUTOCAP_NORMAL];
+    if(decl->slotMask & (1U << LRELEMENTSLOT_TEXTURE2)) caps |= col->autoCaps[LRAUTOCAP_TEXTURE2];
+    return caps;
 }
 
 void LR_Shader_SetFsMaterial(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size) 
 {
-    if(sh->pos_fsMaterial == -1) return;
+    if(sh->pos_fsMaterial.location == -1) return;
     if(sh->hash_fsMaterial == hash) return;
     sh->hash_fsMaterial = hash;
-    LR_BindProgram(ctx, sh->programID);
-    glUniform4fv(sh->pos_fsMaterial, (size / 16), (GLfloat*)data);
+    if(sh->fsMaterialSize && size > sh->fsMaterialSize) size = sh->fsMaterialSize;
+    SetUniform4fv(ctx, &sh->pos_fsMaterial, (size / 16), (GLfloat*)data);
 }
 
 void LR_Shader_SetVsMaterial(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size)
 {
-    if(sh->pos_vsMaterial == -1) return;
+    if(sh->pos_vsMaterial.location == -1) return;
     if(sh->hash_vsMaterial == hash) return;
     sh->hash_vsMaterial = hash;
-    LR_BindProgram(ctx, sh->programID);
-    glUniform4fv(sh->pos_vsMaterial, (size / 16), (GLfloat*)data);
+    if(sh->vsMaterialSize && size > sh->vsMaterialSize) size = sh->vsMaterialSize;
+    SetUniform4fv(ctx, &sh->pos_vsMaterial, (size / 16), (GLfloat*)data);
 }
 
-void LR_Shader_SetLighting(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size)
+void LR_Shader_SetLighting(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size, int uboOffset)
 {
-    if(sh->pos_Lighting == -1) return;
+    if(sh->lightingBlockSize) {
+        /* the range must cover the whole block, the ring has slack at the end for this */
+        int rangeSize = size > sh->lightingBlockSize ? size : sh->lightingBlockSize;
+        LR_UniformRing_Bind(ctx, &ctx->uniformRing, LR_UBO_BINDING_LIGHTING, uboOffset, rangeSize);
+        return;
+    }
+    if(sh->pos_Lighting.location == -1) return;
     if(sh->hash_Lighting == hash && sh->size_Lighting == size) return;
     sh->hash_Lighting = hash;
     sh->size_Lighting = size;
-    LR_BindProgram(ctx, sh->programID);
-    glUniform4fv(sh->pos_Lighting, (size / 16), (GLfloat*)data);
+    SetUniform4fv(ctx, &sh->pos_Lighting, (size / 16), (GLfloat*)data);
 }
 
 void LR_Shader_SetUniformBlock(LR_Context *ctx, LR_Shader *sh, int hash, const char *name)
 {
     if(sh->currentUniformBlock == hash) return;
     sh->currentUniformBlock = hash;
-    GLuint index = glGetUniformBlockIndex(sh->programID, name);
-    if(index != GL_INVALID_INDEX) {
-        glUniformBlockBinding(sh->programID, index, 1);
+    GLuint programs[2];
+    int count = ShaderPrograms(sh, programs);
+    for(int i = 0; i < count; i++) {
+        GLuint index = glGetUniformBlockIndex(programs[i], name);
+        if(index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(programs[i], index, LR_UBO_BINDING_USER);
+        }
     }
 }
 
@@ -5,20 +5,78 @@
 
 #define LR_MAX_SAMPLERS (8)
 
+/* compiled stage, shared between every program linked from the same source */
+typedef struct LR_ShaderStage {
+    GLuint id;
+    GLenum type;
+    uint64_t hash;
+    int length;
+    char *source;
+    int refCount;
+    /* separable program for pipelines, linked on first use */
+    GLuint program;
+    LR_Shader *owner;
+} LR_ShaderStage;
+
+/* resources a variant was compiled to use, from lrshadertool's reflection
+ * records. Lets creation skip queries and uploads the variant never reads. */
+#define LR_REFL_VIEW (1 << 0)
+#define LR_REFL_PROJECTION (1 << 1)
+#define LR_REFL_VIEWPROJECTION (1 << 2)
+#define LR_REFL_WORLD (1 << 3)
+#define LR_REFL_NORMAL (1 << 4)
+#define LR_REFL_VSMATERIAL (1 << 5)
+#define LR_REFL_FSMATERIAL (1 << 6)
+#define LR_REFL_LIGHTING (1 << 7)
+#define LR_REFL_TRANSFORMINDEX (1 << 8)
+#define LR_REFL_CAMERA_BLOCK (1 << 9)
+#define LR_REFL_TRANSFORMS_BLOCK (1 << 10)
+#define LR_REFL_LIGHTING_BLOCK (1 << 11)
+#define LR_MAX_REFL_NAME (64)
+
+typedef struct LR_ShaderReflection {
+    uint32_t uniforms; /* LR_REFL_* */
+    uint32_t attributes; /* 1 << LRELEMENTSLOT */
+    int vsMaterialSize;
+    int fsMaterialSize;
+    int nsamplers;
+    char samplerNames[LR_MAX_SAMPLERS][LR_MAX_REFL_NAME];
+    int samplerUnits[LR_MAX_SAMPLERS];
+} LR_ShaderReflection;
+
+/* with separate shader objects a uniform can live in both stage programs
+ * and must be set on each of them */
+typedef struct LR_Uniform {
+    GLint location; /* -1 when no program has it */
+    GLuint programs[2];
+    GLint locations[2]; /* per program, -1 where unused */
+} LR_Uniform;
+
+typedef struct LR_ReflectedSampler {
+    uint32_t hash;
+    int unit; /* currently set on the program */
+    LR_Uniform location;
+} LR_ReflectedSampler;
+
 struct LR_Shader {
-    GLuint programID;
-    GLuint vertexID;
-    GLuint fragmentID;
-    GLint samplerLocations[LR_MAX_SAMPLERS];
+    GLuint programID; /* 0 when built as a pipeline */
+    GLuint pipeline;
+    LR_ShaderStage *vertex;
+    LR_ShaderStage *fragment;
+    int refCount;
+    LR_Uniform samplerLocations[LR_MAX_SAMPLERS];
     int samplerHashes[LR_MAX_SAMPLERS];
-    GLint posView;
-    GLint posProjection;
-    GLint posViewProjection;
-    GLint posWorld;
-    GLint posNormal;
-    GLint pos_vsMaterial;
-    GLint pos_fsMaterial;
-    GLint pos_Lighting;
+    LR_Uniform posView;
+    LR_Uniform posProjection;
+    LR_Uniform posViewProjection;
+    LR_Uniform posWorld;
+    LR_Uniform posNormal;
+    LR_Uniform pos_vsMaterial;
+    LR_Uniform pos_fsMaterial;
+    LR_Uniform pos_Lighting;
+    LR_Uniform posTransformIndex;
+    int hasCameraBlock;
+    int lightingBlockSize;
     int currentUniformBlock;
     int hash_fsMaterial;
     int hash_vsMaterial;
@@ -26,6 +84,12 @@ struct LR_Shader {
     int hash_Lighting;
     int size_Lighting; 
     uint64_t currentTransform;
+    /* set when created from reflection records */
+    int reflected;
+    int vsMaterialSize;
+    int fsMaterialSize;
+    int reflSamplerCount;
+    LR_ReflectedSampler reflSamplers[LR_MAX_SAMPLERS];
 };
 
 #define LR_MAX_VERTEX_PAIRS (8)
@@ -51,7 +115,19 @@ struct LR_ShaderCollection {
     ShaderVariants defPair; //204 bytes
     ShaderVertexPair vertexSpecific[LR_MAX_VERTEX_PAIRS]; //1696 bytes
     int vertexSpecificCount; //4 bytes
-}; //1904 bytes
+    int autoCaps[LRAUTOCAP_COUNT]; //16 bytes
+}; //1920 bytes
+
+/* deletes any programs and stages still alive when the context is destroyed */
+void LR_Shader_DestroyCache(LR_Context *ctx);
+
+/* returns 0 if the text is malformed or holds no records, callers then
+ * create the shader without reflection */
+int LR_ShaderReflection_Parse(const char *text, LR_ShaderReflection *refl);
+LR_Shader *LR_Shader_CreateReflected(LR_Context *ctx, const char *vertex_source, const char *fragment_source, const LR_ShaderReflection *refl);
+
+/* binds the program or pipeline, must be called before setting any uniforms */
+void LR_Shader_Bind(LR_Context *ctx, LR_Shader *shader);
 
 void LR_Shader_ResetSamplers(LR_Context *ctx, LR_Shader *shader);
 
@@ -59,10 +135,12 @@ void LR_Shader_ResetSamplers(LR_Context *ctx, LR_Shader *shader);
 void LR_Shader_SetSamplerIndex(LR_Context *ctx, LR_Shader *shader, const char *sampler, int hash, int index);
 
 LR_Shader* LR_ShaderCollection_GetShader(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, int caps);
+/* caps bits for automatic features present in this draw */
+int LR_ShaderCollection_AutoCaps(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, LR_Handle lighting);
 void LR_Shader_SetCamera(LR_Context *ctx, LR_Shader *shader);
 void LR_Shader_SetTransform(LR_Context *ctx, LR_Shader *shader, LR_Handle transform);
 void LR_Shader_SetFsMaterial(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size);
 void LR_Shader_SetVsMaterial(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size);
-void LR_Shader_SetLighting(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size);
+void LR_Shader_SetLighting(LR_Context *ctx, LR_Shader *sh, int hash, void *data, int size, int uboOffset);
 void LR_Shader_SetUniformBlock(LR_Context *ctx, LR_Shader *sh, int hash, const char *name);
 #endif
@@ -1,104 +1,417 @@
 #include <lancerrender_shaderfile.h>
 #include "miniz.h"
 #include "lr_errors.h"
+#include "lr_shader.h"
 
 typedef struct GlslShader {
     int caps;
     char *vertex;
     char *fragment;
+    char *reflection; /* v3 and up, may be NULL */
 } GlslShader;
 
 typedef struct BuiltShaderFile {
     int nshaders;
     GlslShader *shaders;
+    /* v1: sources point into this buffer */
+    unsigned char *strings;
+    /* v2: sources decoded on demand, indexed by string table entry */
+    char **decoded;
+    int ndecoded;
 } BuiltShaderFile;
 
+#define SHADERFILE_MAGIC_V0 (0xABCDABCD)
+#define SHADERFILE_MAGIC_V1 (0xABCDABCE)
+#define SHADERFILE_MAGIC_V2 (0xABCDABCF)
+#define SHADERFILE_MAGIC_V3 (0xABCDABD0)
+
+/* caps == NULL selects every variant */
+static int WantCaps(const int *caps, int ncaps, int c)
+{
+    if(!caps) return 1;
+    for(int i = 0; i < ncaps; i++) {
+        if(caps[i] == c) return 1;
+    }
+    return 0;
+}
+
 static void FreeParsedFile(BuiltShaderFile *file)
 {
-    for(int i = 0; i < file->nshaders; i++) {
-        free(file->shaders[i].vertex);
-        free(file->shaders[i].fragment);
+    if(file->decoded) {
+        for(int i = 0; i < file->ndecoded; i++) free(file->decoded[i]);
+        free(file->decoded);
+    } else if(file->strings) {
+        free(file->strings);
+    } else {
+        for(int i = 0; i < file->nshaders; i++) {
+            free(file->shaders[i].vertex);
+            free(file->shaders[i].fragment);
+        }
     }
     free(file->shaders);
     free(file);
 }
 
-static BuiltShaderFile* ReadFile(SDL_RWops *rw)
+/* Inflates a zlib stream read from the RWops in fixed-size chunks through
+ * the 32K dictionary, so only the final buffers are ever full size */
+#define INFLATE_CHUNK (16384)
+
+typedef struct InflateStream {
+    SDL_RWops *rw;
+    uint32_t compRemaining;
+    size_t inPos;
+    size_t inAvail;
+    size_t dictPos;
+    size_t outAvail;
+    int finished;
+    int error;
+    tinfl_decompressor inflator;
+    mz_uint8 in[INFLATE_CHUNK];
+    mz_uint8 dict[TINFL_LZ_DICT_SIZE];
+} InflateStream;
+
+static void Inflate_Reset(InflateStream *s, SDL_RWops *rw, uint32_t compsize)
 {
-    uint32_t magic;
-    uint32_t compsize;
-    uint32_t decompsize;
-    if(!rw->read(rw, &magic, 4, 1)) return NULL;
-    if(magic != 0xABCDABCD) return NULL;
-    if(!rw->read(rw, &compsize, 4, 1)) return NULL;
-    if(!rw->read(rw, &decompsize, 4, 1)) return NULL;
-    unsigned char *indata = malloc(compsize);
-    if(!rw->read(rw, indata, compsize, 1)) {
-        free(indata);
+    s->rw = rw;
+    s->compRemaining = compsize;
+    s->inPos = s->inAvail = 0;
+    s->dictPos = s->outAvail = 0;
+    s->finished = s->error = 0;
+    tinfl_init(&s->inflator);
+}
+
+/* copies exactly len decoded bytes to dst */
+static int Inflate_Read(InflateStream *s, void *dst, size_t len)
+{
+    mz_uint8 *out = dst;
+    while(len) {
+        if(s->outAvail) {
+            /* decoding is only resumed once everything was handed out, so the
+             * pending bytes end at dictPos and never wrap */
+            size_t n = s->outAvail < len ? s->outAvail : len;
+            size_t start = (s->dictPos - s->outAvail) & (TINFL_LZ_DICT_SIZE - 1);
+            memcpy(out, s->dict + start, n);
+            out += n;
+            len -= n;
+            s->outAvail -= n;
+            continue;
+        }
+        if(s->finished || s->error) return 0;
+        if(!s->inAvail && s->compRemaining) {
+            size_t chunk = s->compRemaining < INFLATE_CHUNK ? s->compRemaining : INFLATE_CHUNK;
+            if(!s->rw->read(s->rw, s->in, chunk, 1)) {
+                s->error = 1;
+                return 0;
+            }
+            s->compRemaining -= (uint32_t)chunk;
+            s->inPos = 0;
+            s->inAvail = chunk;
+        }
+        size_t inBytes = s->inAvail;
+        size_t outBytes = TINFL_LZ_DICT_SIZE - s->dictPos;
+        tinfl_status status = tinfl_decompress(
+            &s->inflator, s->in + s->inPos, &inBytes,
+            s->dict, s->dict + s->dictPos, &outBytes,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | (s->compRemaining ? TINFL_FLAG_HAS_MORE_INPUT : 0)
+        );
+        s->inPos += inBytes;
+        s->inAvail -= inBytes;
+        s->dictPos = (s->dictPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+        s->outAvail = outBytes;
+        if(status < TINFL_STATUS_DONE ||
+            (status == TINFL_STATUS_NEEDS_MORE_INPUT && !s->compRemaining && !s->inAvail && !outBytes)) {
+            s->error = 1;
+            return 0;
+        }
+        if(status == TINFL_STATUS_DONE) s->finished = 1;
+    }
+    return 1;
+}
+
+/* deflate expands at most ~1032:1, a larger stored size is corrupt and is
+ * rejected before anything is allocated for it */
+#define INFLATE_MAX_RATIO (1032)
+static int Inflate_SizeValid(uint32_t compsize, uint32_t decompsize)
+{
+    return (uint64_t)decompsize <= (uint64_t)compsize * INFLATE_MAX_RATIO;
+}
+
+/* the stream must end, with a valid checksum, exactly where the data did */
+static int Inflate_AtEnd(InflateStream *s)
+{
+    unsigned char extra;
+    if(Inflate_Read(s, &extra, 1)) return 0;
+    return s->finished && !s->error;
+}
+
+static int ReadInt(InflateStream *s, uint32_t *remaining, uint32_t *output)
+{
+    if(*remaining < 4) return 0;
+    *remaining -= 4;
+    return Inflate_Read(s, output, 4);
+}
+
+/* reads a string of len bytes into a new zero-terminated buffer */
+static char *ReadString(InflateStream *s, uint32_t *remaining, uint32_t len)
+{
+    if(len > *remaining) return NULL;
+    char *str = malloc(len + 1);
+    if(!str) return NULL;
+    if(!Inflate_Read(s, str, len)) {
+        free(str);
         return NULL;
     }
+    str[len] = 0;
+    *remaining -= len;
+    return str;
+}
+
+static BuiltShaderFile* ParseV0(InflateStream *s, uint32_t decompsize)
+{
+    uint32_t remaining = decompsize;
+    uint32_t nshaders;
+    if(!ReadInt(s, &remaining, &nshaders)) return NULL;
+    /* each entry is at least three ints */
+    if(nshaders > remaining / 12) return NULL;
+    BuiltShaderFile *shf = malloc(sizeof(BuiltShaderFile));
+    shf->strings = NULL;
+    shf->decoded = NULL;
+    shf->nshaders = 0;
+    shf->shaders = malloc(nshaders * sizeof(GlslShader) + 1);
+    for(uint32_t i = 0; i < nshaders; i++) {
+        GlslShader *sh = &shf->shaders[i];
+        uint32_t caps, vlen, flen;
+        if(!ReadInt(s, &remaining, &caps)) goto fail;
+        sh->caps = (int)caps;
+        sh->reflection = NULL;
+        if(!ReadInt(s, &remaining, &vlen)) goto fail;
+        if(!(sh->vertex = ReadString(s, &remaining, vlen))) goto fail;
+        if(!ReadInt(s, &remaining, &flen) ||
+            !(sh->fragment = ReadString(s, &remaining, flen))) {
+            free(sh->vertex);
+            goto fail;
+        }
+        shf->nshaders++;
+    }
+    if(remaining) goto fail;
+    return shf;
+fail:
+    FreeParsedFile(shf);
+    return NULL;
+}
+
+/* v1: zero-terminated string table followed by (caps, vertex, fragment)
+ * entries indexing into it, sources are used in place */
+static BuiltShaderFile* ParseV1(InflateStream *s, uint32_t decompsize)
+{
     unsigned char *decomp = malloc(decompsize);
-    mz_ulong decompResult = decompsize;
-    int res = uncompress(decomp, &decompResult, indata, compsize);
-    free(indata);
-    if(decompsize != decompResult ||
-        res != Z_OK) {
+    if(!decomp || !Inflate_Read(s, decomp, decompsize)) {
         free(decomp);
         return NULL;
     }
-    BuiltShaderFile *shf = malloc(sizeof(BuiltShaderFile));
-    unsigned char *dcptr = decomp;
     #define READ_INT(output) do { \
-        output = *(uint32_t*)dcptr; \
+        memcpy(&(output), dcptr, 4); \
         dcptr += 4; \
     } while(0)
-    READ_INT(shf->nshaders);
-    shf->shaders = malloc(shf->nshaders * sizeof(GlslShader));
-    for(int i = 0; i < shf->nshaders; i++) {
+    unsigned char *dcptr = decomp;
+    unsigned char *end = decomp + decompsize;
+    uint32_t nstrings;
+    if(end - dcptr < 4) goto fail;
+    READ_INT(nstrings);
+    if(nstrings > decompsize / 5) goto fail;
+    char **strings = malloc(nstrings * sizeof(char*) + 1);
+    for(uint32_t i = 0; i < nstrings; i++) {
+        uint32_t len;
+        if(end - dcptr < 4) goto failstrings;
+        READ_INT(len);
+        if((uint32_t)(end - dcptr) <= len || dcptr[len] != 0) goto failstrings;
+        strings[i] = (char*)dcptr;
+        dcptr += len + 1;
+    }
+    uint32_t nshaders;
+    if(end - dcptr < 4) goto failstrings;
+    READ_INT(nshaders);
+    if((uint32_t)(end - dcptr) / 12 < nshaders) goto failstrings;
+    BuiltShaderFile *shf = malloc(sizeof(BuiltShaderFile));
+    shf->strings = decomp;
+    shf->decoded = NULL;
+    shf->nshaders = (int)nshaders;
+    shf->shaders = malloc(nshaders * sizeof(GlslShader) + 1);
+    for(uint32_t i = 0; i < nshaders; i++) {
+        uint32_t vidx, fidx;
         READ_INT(shf->shaders[i].caps);
-        int vlen, flen;
-        READ_INT(vlen);
-        shf->shaders[i].vertex = malloc(vlen + 1);
-        memcpy(shf->shaders[i].vertex, dcptr, vlen);
-        dcptr += vlen;
-        shf->shaders[i].vertex[vlen] = 0;
-        READ_INT(flen);
-        shf->shaders[i].fragment = malloc(flen + 1);
-        memcpy(shf->shaders[i].fragment, dcptr, flen);
-        shf->shaders[i].fragment[flen] = 0;
-        dcptr += flen;
+        READ_INT(vidx);
+        READ_INT(fidx);
+        if(vidx >= nstrings || fidx >= nstrings) {
+            free(shf->shaders);
+            free(shf);
+            goto failstrings;
+        }
+        shf->shaders[i].vertex = strings[vidx];
+        shf->shaders[i].fragment = strings[fidx];
+        shf->shaders[i].reflection = NULL;
     }
     #undef READ_INT
+    free(strings);
+    return shf;
+failstrings:
+    free(strings);
+fail:
     free(decomp);
+    return NULL;
+}
+
+typedef struct V2String {
+    uint32_t offset; /* from the start of the file */
+    uint32_t compsize;
+    uint32_t size;
+} V2String;
+
+static char *DecodeV2String(SDL_RWops *rw, Sint64 base, Sint64 fileSize, V2String *str, InflateStream *s)
+{
+    if(fileSize >= 0 && (Sint64)str->offset + str->compsize > fileSize - base) return NULL;
+    if(!Inflate_SizeValid(str->compsize, str->size)) return NULL;
+    if(rw->seek(rw, base + str->offset, RW_SEEK_SET) < 0) return NULL;
+    Inflate_Reset(s, rw, str->compsize);
+    uint32_t remaining = str->size;
+    char *out = ReadString(s, &remaining, str->size);
+    if(out && !Inflate_AtEnd(s)) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+/* v2: uncompressed index followed by independently compressed sources,
+ * only the sources referenced by the selected variants are read.
+ * v3 adds a reflection string to each entry. */
+static BuiltShaderFile* ParseV2(SDL_RWops *rw, Sint64 base, int fields, const int *caps, int ncaps)
+{
+    uint32_t nstrings, nshaders;
+    if(!rw->read(rw, &nstrings, 4, 1)) return NULL;
+    if(!rw->read(rw, &nshaders, 4, 1)) return NULL;
+    if(nstrings > (1 << 20) || nshaders > (1 << 20)) return NULL;
+    Sint64 fileSize = rw->size(rw);
+    V2String *index = malloc(nstrings * sizeof(V2String) + 1);
+    uint32_t *entries = malloc(nshaders * fields * sizeof(uint32_t) + 1);
+    BuiltShaderFile *shf = malloc(sizeof(BuiltShaderFile));
+    shf->strings = NULL;
+    shf->nshaders = (int)nshaders;
+    shf->shaders = malloc(nshaders * sizeof(GlslShader) + 1);
+    shf->ndecoded = (int)nstrings;
+    shf->decoded = calloc(nstrings + 1, sizeof(char*));
+    InflateStream *stream = malloc(sizeof(InflateStream));
+    if(nstrings && !rw->read(rw, index, sizeof(V2String), nstrings)) goto fail;
+    if(nshaders && !rw->read(rw, entries, fields * sizeof(uint32_t), nshaders)) goto fail;
+    for(uint32_t i = 0; i < nshaders; i++) {
+        uint32_t *e = &entries[i * fields];
+        shf->shaders[i].caps = (int)e[0];
+        shf->shaders[i].vertex = NULL;
+        shf->shaders[i].fragment = NULL;
+        shf->shaders[i].reflection = NULL;
+        for(int j = 1; j < fields; j++) {
+            if(e[j] >= nstrings) goto fail;
+        }
+        if(!WantCaps(caps, ncaps, (int)e[0])) continue;
+        for(int j = 1; j < fields; j++) {
+            if(!shf->decoded[e[j]]) {
+                shf->decoded[e[j]] = DecodeV2String(rw, base, fileSize, &index[e[j]], stream);
+                if(!shf->decoded[e[j]]) goto fail;
+            }
+        }
+        shf->shaders[i].vertex = shf->decoded[e[1]];
+        shf->shaders[i].fragment = shf->decoded[e[2]];
+        if(fields > 3) shf->shaders[i].reflection = shf->decoded[e[3]];
+    }
+    free(stream);
+    free(index);
+    free(entries);
     return shf;
+fail:
+    free(stream);
+    free(index);
+    free(entries);
+    FreeParsedFile(shf);
+    return NULL;
 }
 
+static BuiltShaderFile* ReadFile(SDL_RWops *rw, const int *caps, int ncaps)
+{
+    uint32_t magic;
+    uint32_t compsize;
+    uint32_t decompsize;
+    Sint64 base = rw->seek(rw, 0, RW_SEEK_CUR);
+    if(!rw->read(rw, &magic, 4, 1)) return NULL;
+    if(magic == SHADERFILE_MAGIC_V2) return ParseV2(rw, base, 3, caps, ncaps);
+    if(magic == SHADERFILE_MAGIC_V3) return ParseV2(rw, base, 4, caps, ncaps);
+    if(magic != SHADERFILE_MAGIC_V0 && magic != SHADERFILE_MAGIC_V1) return NULL;
+    if(!rw->read(rw, &compsize, 4, 1)) return NULL;
+    if(!rw->read(rw, &decompsize, 4, 1)) return NULL;
+    Sint64 fileSize = rw->size(rw);
+    if(fileSize >= 0 && (Sint64)compsize > fileSize - (base + 12)) return NULL;
+    if(!Inflate_SizeValid(compsize, decompsize)) return NULL;
+    InflateStream *stream = malloc(sizeof(InflateStream));
+    Inflate_Reset(stream, rw, compsize);
+    BuiltShaderFile *file;
+    if(magic == SHADERFILE_MAGIC_V1)
+        file = ParseV1(stream, decompsize);
+    else
+        file = ParseV0(stream, decompsize);
+    if(file && !Inflate_AtEnd(stream)) {
+        FreeParsedFile(file);
+        file = NULL;
+    }
+    free(stream);
+    return file;
+}
 
+static LR_Shader *CreateShader(LR_Context *ctx, GlslShader *glsl)
+{
+    LR_ShaderReflection refl;
+    if(glsl->reflection && *glsl->reflection) {
+        if(LR_ShaderReflection_Parse(glsl->reflection, &refl))
+            return LR_Shader_CreateReflected(ctx, glsl->vertex, glsl->fragment, &refl);
+        LR_WarningFunc(ctx, "ignoring malformed shader reflection data");
+    }
+    return LR_Shader_Create(ctx, glsl->vertex, glsl->fragment);
+}
 
-LREXPORT void LR_ShaderCollection_DefaultShadersFromFile(LR_Context *ctx, LR_ShaderCollection *col, SDL_RWops *rw)
+LREXPORT void LR_ShaderCollection_DefaultShadersFromFileCaps(LR_Context *ctx, LR_ShaderCollection *col, SDL_RWops *rw, const int *caps, int ncaps)
 {
-    BuiltShaderFile *file = ReadFile(rw);
+    BuiltShaderFile *file = ReadFile(rw, caps, ncaps);
     if(!file) {
         LR_CriticalErrorFunc(ctx, "invalid shader file passed to LR_ShaderCollection_DefaultShadersFromFile");
         return;
     }
     for(int i = 0; i < file->nshaders; i++) {
-        LR_Shader *sh = LR_Shader_Create(ctx, file->shaders[i].vertex, file->shaders[i].fragment);
+        if(!WantCaps(caps, ncaps, file->shaders[i].caps)) continue;
+        LR_Shader *sh = CreateShader(ctx, &file->shaders[i]);
         LR_ShaderCollection_AddDefaultShader(ctx, col, file->shaders[i].caps, sh);
     }
     FreeParsedFile(file);
 }
 
-LREXPORT void LR_ShaderCollection_AddShadersFromFile(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, SDL_RWops *rw)
+LREXPORT void LR_ShaderCollection_DefaultShadersFromFile(LR_Context *ctx, LR_ShaderCollection *col, SDL_RWops *rw)
+{
+    LR_ShaderCollection_DefaultShadersFromFileCaps(ctx, col, rw, NULL, 0);
+}
+
+LREXPORT void LR_ShaderCollection_AddShadersFromFileCaps(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, SDL_RWops *rw, const int *caps, int ncaps)
 {
-    BuiltShaderFile *file = ReadFile(rw);
+    BuiltShaderFile *file = ReadFile(rw, caps, ncaps);
     if(!file) {
         LR_CriticalErrorFunc(ctx, "invalid shader file passed to LR_ShaderCollection_AddShadersFromFile");
         return;
     }
     for(int i = 0; i < file->nshaders; i++) {
-        LR_Shader *sh = LR_Shader_Create(ctx, file->shaders[i].vertex, file->shaders[i].fragment);
+        if(!WantCaps(caps, ncaps, file->shaders[i].caps)) continue;
+        LR_Shader *sh = CreateShader(ctx, &file->shaders[i]);
         LR_ShaderCollection_AddShaderByVertex(ctx, col, decl, file->shaders[i].caps, sh);
     }
     FreeParsedFile(file);
-}
\ No newline at end of file
+}
+
+LREXPORT void LR_ShaderCollection_AddShadersFromFile(LR_Context *ctx, LR_ShaderCollection *col, LR_VertexDeclaration *decl, SDL_RWops *rw)
+{
+    LR_ShaderCollection_AddShadersFromFileCaps(ctx, col, decl, rw, NULL, 0);
+}
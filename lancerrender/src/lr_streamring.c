@@ -0,0 +1,282 @@
+#include "lr_streamring.h"
+#include "lr_context.h"
+#include "lr_errors.h"
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#define STREAM_SEGMENT_RESERVES (2)
+
+#define HAS_SHADOW(s) ((s)->mode == LRBUFFERUPDATE_SUBDATA || (s)->mode == LRBUFFERUPDATE_ORPHAN)
+#define SEGMENTS(s) ((s)->mode == LRBUFFERUPDATE_UNSYNCHRONIZED ? LR_RING_SEGMENTS : 1)
+
+/* data written between frames belongs to the next one */
+static int RingFrame(LR_Context *ctx)
+{
+    return ctx->inframe ? ctx->currentFrame : ctx->currentFrame + 1;
+}
+
+static GLsizeiptr TotalBytes(LR_StreamRing *s)
+{
+    return (GLsizeiptr)s->segmentSize * SEGMENTS(s) * s->unit;
+}
+
+/* creates the GL buffer for the current mode and segment size */
+static void Allocate(LR_Context *ctx, LR_StreamRing *s)
+{
+    GLsizeiptr total = TotalBytes(s);
+    GL_CHECK(ctx, glGenBuffers(1, &s->buffer));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+    s->persistent = NULL;
+    if(s->mode == LRBUFFERUPDATE_UNSYNCHRONIZED && ctx->bufferStorage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GL_CHECK(ctx, glBufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags));
+        s->persistent = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+        if(!s->persistent)
+            LR_CriticalErrorFunc(ctx, "LR_StreamRing: persistent glMapBufferRange failed");
+    } else {
+        GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_STREAM_DRAW));
+    }
+}
+
+static void ReleaseBuffer(LR_Context *ctx, LR_StreamRing *s)
+{
+    if(s->persistent) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        s->persistent = NULL;
+    }
+    glDeleteBuffers(1, &s->buffer);
+    s->buffer = 0;
+}
+
+static void DeleteFences(LR_StreamRing *s)
+{
+    for(int i = 0; i < LR_RING_SEGMENTS; i++) {
+        if(s->fences[i]) glDeleteSync(s->fences[i]);
+        s->fences[i] = 0;
+    }
+}
+
+void LR_StreamRing_Init(LR_Context *ctx, LR_StreamRing *s, int unit, int reserve, LRBUFFERUPDATE mode)
+{
+    memset(s, 0, sizeof(LR_StreamRing));
+    s->unit = unit;
+    s->mode = mode;
+    s->reserve = reserve;
+    s->segmentSize = reserve * STREAM_SEGMENT_RESERVES;
+    Allocate(ctx, s);
+    if(HAS_SHADOW(s)) s->shadow = malloc((size_t)reserve * unit);
+    s->frameEnd = s->segmentSize;
+    s->frame = RingFrame(ctx);
+}
+
+void LR_StreamRing_Release(LR_Context *ctx, LR_StreamRing *s)
+{
+    if(!s->buffer) return;
+    DeleteFences(s);
+    ReleaseBuffer(ctx, s);
+    free(s->shadow);
+    s->shadow = NULL;
+}
+
+void LR_StreamRing_SetMode(LR_Context *ctx, LR_StreamRing *s, LRBUFFERUPDATE mode)
+{
+    LR_AssertTrue(ctx, !s->streaming);
+    if(s->mode == mode) return;
+    int unit = s->unit;
+    int reserve = s->reserve;
+    LR_StreamRing_Release(ctx, s);
+    LR_StreamRing_Init(ctx, s, unit, reserve, mode);
+}
+
+static void *Map(LR_Context *ctx, LR_StreamRing *s, GLbitfield extraFlags)
+{
+    if(s->persistent) return s->persistent + (size_t)s->base * s->unit;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+    void *ptr = glMapBufferRange(
+        GL_COPY_WRITE_BUFFER,
+        (GLintptr)s->base * s->unit,
+        (GLsizeiptr)s->reserve * s->unit,
+        GL_MAP_WRITE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT | extraFlags
+    );
+    if(!ptr) LR_CriticalErrorFunc(ctx, "LR_StreamRing: glMapBufferRange failed");
+    return ptr;
+}
+
+/* flushes [from, to) of the current reservation */
+static void Unmap(LR_Context *ctx, LR_StreamRing *s, int from, int to)
+{
+    if(s->persistent) return;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+    if(to > from) {
+        glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, (GLintptr)from * s->unit, (GLsizeiptr)(to - from) * s->unit);
+    }
+    GL_CHECK(ctx, glUnmapBuffer(GL_COPY_WRITE_BUFFER));
+}
+
+static void NextFrame(LR_Context *ctx, LR_StreamRing *s, int frame)
+{
+    s->frame = frame;
+    s->head = 0;
+    if(s->mode == LRBUFFERUPDATE_UNSYNCHRONIZED) {
+        /* a later frame has started, so every draw reading the last one's
+         * data has been flushed */
+        for(int i = 0; i < LR_RING_SEGMENTS; i++) {
+            if(i != s->segment && !s->fenceAll) continue;
+            if(s->fences[i]) glDeleteSync(s->fences[i]);
+            s->fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        s->fenceAll = 0;
+        s->segment = (s->segment + 1) % LR_RING_SEGMENTS;
+        GLsync fence = s->fences[s->segment];
+        if(fence) {
+            GLenum res;
+            do {
+                res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            } while(res == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fence);
+            s->fences[s->segment] = 0;
+        }
+    }
+    s->frameStart = s->segment * s->segmentSize;
+    s->frameEnd = s->frameStart + s->segmentSize;
+}
+
+/* Moves to a larger buffer with room for `required` elements from the frame
+ * start. [frameStart, copyEnd) is copied to the same offsets so draws
+ * recorded earlier in the frame still find their data. */
+static void Grow(LR_Context *ctx, LR_StreamRing *s, int required, int copyEnd)
+{
+    LR_StreamRing old = *s;
+    int segmentSize = s->segmentSize;
+    while(segmentSize < required) segmentSize *= 2;
+    if(segmentSize < s->reserve * STREAM_SEGMENT_RESERVES) segmentSize = s->reserve * STREAM_SEGMENT_RESERVES;
+    s->segmentSize = segmentSize;
+    Allocate(ctx, s);
+    if(s->mode == LRBUFFERUPDATE_UNSYNCHRONIZED) {
+        /* the old fences guard the old buffer, the frame keeps its offsets
+         * and may now run into any segment of the new one */
+        DeleteFences(s);
+        s->frameEnd = segmentSize * LR_RING_SEGMENTS;
+        s->fenceAll = 1;
+    } else {
+        s->frameEnd = segmentSize;
+    }
+    if(copyEnd > s->frameStart) {
+        glBindBuffer(GL_COPY_READ_BUFFER, old.buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+        GL_CHECK(ctx, glCopyBufferSubData(
+            GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            (GLintptr)s->frameStart * s->unit, (GLintptr)s->frameStart * s->unit,
+            (GLsizeiptr)(copyEnd - s->frameStart) * s->unit
+        ));
+    }
+    ReleaseBuffer(ctx, &old);
+}
+
+static void *BeginAt(LR_Context *ctx, LR_StreamRing *s, int frame)
+{
+    LR_AssertTrue(ctx, !s->streaming);
+    if(s->frame != frame) NextFrame(ctx, s, frame);
+    if(s->frameStart + s->head + s->reserve > s->frameEnd)
+        Grow(ctx, s, s->head + s->reserve, s->frameStart + s->head);
+    s->streaming = 1;
+    s->flushStart = 0;
+    s->base = s->frameStart + s->head;
+    switch(s->mode) {
+        case LRBUFFERUPDATE_ORPHAN:
+            if(!s->head) {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+                GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, TotalBytes(s), NULL, GL_STREAM_DRAW));
+            }
+            /* fall through */
+        case LRBUFFERUPDATE_SUBDATA:
+            return s->shadow;
+        case LRBUFFERUPDATE_MAPINVALIDATE:
+            return Map(ctx, s, s->head ? GL_MAP_INVALIDATE_RANGE_BIT : GL_MAP_INVALIDATE_BUFFER_BIT);
+        default:
+            return Map(ctx, s, GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+}
+
+void *LR_StreamRing_Begin(LR_Context *ctx, LR_StreamRing *s)
+{
+    return BeginAt(ctx, s, RingFrame(ctx));
+}
+
+void LR_StreamRing_Finish(LR_Context *ctx, LR_StreamRing *s, int count)
+{
+    LR_AssertTrue(ctx, s->streaming);
+    LR_AssertTrue(ctx, count <= s->reserve);
+    s->streaming = 0;
+    if(HAS_SHADOW(s)) {
+        if(count) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)s->base * s->unit, (GLsizeiptr)count * s->unit, s->shadow);
+        }
+    } else {
+        Unmap(ctx, s, s->flushStart, count);
+    }
+    s->head += count;
+}
+
+void *LR_StreamRing_Resize(LR_Context *ctx, LR_StreamRing *s, int reserve)
+{
+    /* mapped modes keep the current reservation in the buffer, shadowed
+     * ones in the CPU copy which is realloc'd with its contents */
+    int kept = (s->streaming && !HAS_SHADOW(s)) ? s->reserve : 0;
+    if(kept) Unmap(ctx, s, s->flushStart, kept);
+    s->reserve = reserve;
+    if(HAS_SHADOW(s)) s->shadow = realloc(s->shadow, (size_t)reserve * s->unit);
+    Grow(ctx, s, s->head + reserve, s->frameStart + s->head + kept);
+    if(!s->streaming) return NULL;
+    if(HAS_SHADOW(s)) return s->shadow;
+    //the copied range must not be overwritten by the new mapping's flush,
+    //and the mapping must wait for the copy
+    s->flushStart = kept;
+    return Map(ctx, s, 0);
+}
+
+static double TimeMilliseconds()
+{
+    return (double)SDL_GetPerformanceCounter() * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+LREXPORT LRBUFFERUPDATE LR_BenchmarkBufferUpdates(LR_Context *ctx, int size, int iterations, double *outTimes)
+{
+    LR_AssertTrue(ctx, !ctx->inframe);
+    /* each upload is consumed by a GPU copy so strategies that stall on
+     * in-flight data pay for it like they would when drawing */
+    GLuint sink;
+    GL_CHECK(ctx, glGenBuffers(1, &sink));
+    glBindBuffer(GL_COPY_READ_BUFFER, sink);
+    GL_CHECK(ctx, glBufferData(GL_COPY_READ_BUFFER, size, NULL, GL_STREAM_COPY));
+    LRBUFFERUPDATE best = LRBUFFERUPDATE_UNSYNCHRONIZED;
+    double bestTime = -1;
+    for(int mode = 0; mode < LRBUFFERUPDATE_COUNT; mode++) {
+        LR_StreamRing ring;
+        LR_StreamRing_Init(ctx, &ring, 1, size, (LRBUFFERUPDATE)mode);
+        glFinish();
+        double start = TimeMilliseconds();
+        for(int i = 0; i < iterations; i++) {
+            /* every upload is its own frame, as when streaming once per frame */
+            void *ptr = BeginAt(ctx, &ring, ring.frame + 1);
+            memset(ptr, i & 0xFF, size);
+            LR_StreamRing_Finish(ctx, &ring, size);
+            glBindBuffer(GL_COPY_READ_BUFFER, ring.buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, sink);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, ring.base, 0, size);
+        }
+        glFinish();
+        double elapsed = TimeMilliseconds() - start;
+        LR_StreamRing_Release(ctx, &ring);
+        if(outTimes) outTimes[mode] = elapsed;
+        if(bestTime < 0 || elapsed < bestTime) {
+            bestTime = elapsed;
+            best = (LRBUFFERUPDATE)mode;
+        }
+    }
+    glDeleteBuffers(1, &sink);
+    return best;
+}
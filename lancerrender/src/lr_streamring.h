@@ -0,0 +1,53 @@
+#ifndef _LR_STREAMRING_H_
+#define _LR_STREAMRING_H_
+#include <lancerrender.h>
+#include <glad/glad.h>
+#include "lr_uniformring.h"
+
+/*
+ * Streamed buffer data written between Begin and Finish. Each Begin hands
+ * out `reserve` elements after everything written earlier in the frame, so
+ * data stays valid until the frame's draws have been flushed. A frame that
+ * runs out of space grows the buffer, copying its data to the same offsets.
+ * How the data reaches GL depends on the LRBUFFERUPDATE mode:
+ * SUBDATA/ORPHAN write a CPU copy and upload it on Finish, ORPHAN orphans
+ * the buffer on the first Begin of a frame,
+ * MAPINVALIDATE maps each reservation, invalidating the whole buffer on the
+ * first Begin of a frame,
+ * UNSYNCHRONIZED gives each frame one of LR_RING_SEGMENTS segments, fenced
+ * once the next frame starts. With GL_ARB_buffer_storage the whole buffer
+ * stays mapped, otherwise each reservation is mapped unsynchronized.
+ * `base` is the element offset of the last Begin, draws must add it.
+ */
+typedef struct LR_StreamRing {
+    GLuint buffer;
+    LRBUFFERUPDATE mode;
+    int unit; //bytes per element
+    int reserve;
+    int segmentSize;
+    int segment;
+    int frameStart; //element offset of this frame's data
+    int frameEnd; //end of the space this frame may use
+    int head; //elements written this frame
+    int base;
+    int frame;
+    int flushStart;
+    int streaming;
+    int fenceAll; //the buffer grew, the frame may span every segment
+    char *persistent;
+    void *shadow;
+    GLsync fences[LR_RING_SEGMENTS];
+} LR_StreamRing;
+
+void LR_StreamRing_Init(LR_Context *ctx, LR_StreamRing *s, int unit, int reserve, LRBUFFERUPDATE mode);
+/* reallocates storage for a new mode, must not be streaming. Data written
+ * earlier in the frame is discarded, call between frames */
+void LR_StreamRing_SetMode(LR_Context *ctx, LR_StreamRing *s, LRBUFFERUPDATE mode);
+void LR_StreamRing_Release(LR_Context *ctx, LR_StreamRing *s);
+void *LR_StreamRing_Begin(LR_Context *ctx, LR_StreamRing *s);
+void LR_StreamRing_Finish(LR_Context *ctx, LR_StreamRing *s, int count);
+/* grows the reservation, keeping anything written since Begin and earlier
+ * in the frame. returns the new write pointer, or NULL if not streaming */
+void *LR_StreamRing_Resize(LR_Context *ctx, LR_StreamRing *s, int reserve);
+
+#endif
@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include "lr_context.h"
 #include "lr_errors.h"
+#include <string.h>
 
 static inline int AlignedIndex(int input, int stride, int align)
 {
@@ -11,19 +12,36 @@ static inline int AlignedIndex(int input, int stride, int align)
     return aOffset / stride;
 }
 
+/* (re)creates storage for the mode's copies, filled from the shadow */
+static void Allocate(LR_Context *ctx, LR_UniformBuffer *ubo, LRBUFFERUPDATE mode)
+{
+    int bytes = ubo->size * ubo->stride;
+    int align = ctx->uboOffsetAlign;
+    ubo->mode = mode;
+    ubo->copies = mode == LRBUFFERUPDATE_UNSYNCHRONIZED ? LR_RING_SEGMENTS : 1;
+    ubo->copyStride = ((bytes + (align - 1)) / align) * align;
+    ubo->current = 0;
+    for(int i = 0; i < LR_RING_SEGMENTS; i++) {
+        ubo->readFrame[i] = ctx->currentFrame - LR_RING_SEGMENTS;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo->gl);
+    GL_CHECK(ctx, glBufferData(GL_UNIFORM_BUFFER, ubo->copyStride * ubo->copies, NULL, GL_STREAM_DRAW));
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, ubo->shadow);
+}
+
 LREXPORT LR_UniformBuffer *LR_UniformBuffer_Create(LR_Context *ctx, int size, int stride)
 {
     LR_AssertTrue(ctx, stride % 16 == 0);
     LR_UniformBuffer *ubo = malloc(sizeof(LR_UniformBuffer));
     glGenBuffers(1, &ubo->gl);
-    glBindBuffer(GL_UNIFORM_BUFFER, ubo->gl);
-    glBufferData(GL_UNIFORM_BUFFER, size * stride, NULL, GL_STREAM_DRAW);
     int lval = stride % ctx->uboOffsetAlign;
     ubo->align = lval ? ubo->align : 0;
     if(ubo->align < stride && lval != 0) //shouldn't happen
         LR_CriticalErrorFunc(ctx, "UBO alignment error");
     ubo->size = size;
     ubo->stride = stride;
+    ubo->shadow = calloc(size, stride);
+    Allocate(ctx, ubo, ctx->bufferUpdate);
     return ubo;
 }
 
@@ -32,15 +50,77 @@ LREXPORT int LR_UniformBuffer_AlignIndex(LR_Context *ctx, LR_UniformBuffer *ubo,
     return AlignedIndex(index, ubo->stride, ubo->align);
 }
 
+static void MapWrite(LR_Context *ctx, LR_UniformBuffer *ubo, void *ptr, int offset, int len, GLbitfield flags)
+{
+    void *dst = glMapBufferRange(GL_UNIFORM_BUFFER, offset, len, GL_MAP_WRITE_BIT | flags);
+    if(!dst) {
+        LR_CriticalErrorFunc(ctx, "LR_UniformBuffer_SetData: glMapBufferRange failed");
+        return;
+    }
+    memcpy(dst, ptr, len);
+    GL_CHECK(ctx, glUnmapBuffer(GL_UNIFORM_BUFFER));
+}
+
+/* LR_BeginFrame has waited for every frame up to LR_RING_SEGMENTS ago */
+static int CopyIdle(LR_Context *ctx, LR_UniformBuffer *ubo, int copy)
+{
+    return ubo->readFrame[copy] <= ctx->currentFrame - LR_RING_SEGMENTS;
+}
+
+static void WriteUnsynchronized(LR_Context *ctx, LR_UniformBuffer *ubo, void *ptr, int offset, int len)
+{
+    GLbitfield flags = GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    if(CopyIdle(ctx, ubo, ubo->current)) {
+        MapWrite(ctx, ubo, ptr, ubo->current * ubo->copyStride + offset, len, flags);
+        return;
+    }
+    /* the current copy may still be read, move to one that is not */
+    for(int i = 1; i < ubo->copies; i++) {
+        int copy = (ubo->current + i) % ubo->copies;
+        if(!CopyIdle(ctx, ubo, copy)) continue;
+        ubo->current = copy;
+        MapWrite(ctx, ubo, ubo->shadow, copy * ubo->copyStride, ubo->size * ubo->stride, flags);
+        return;
+    }
+    /* every copy is in flight (written again after draws this frame) */
+    glBufferSubData(GL_UNIFORM_BUFFER, ubo->current * ubo->copyStride + offset, len, ptr);
+}
+
 LREXPORT void LR_UniformBuffer_SetData(LR_Context *ctx, LR_UniformBuffer *ubo, void* ptr, int stride, int start, int len)
 {
     LR_AssertTrue(ctx, stride == ubo->stride);
+    int offset = start * stride;
+    int bytes = len * stride;
+    memcpy((char*)ubo->shadow + offset, ptr, bytes);
     glBindBuffer(GL_UNIFORM_BUFFER, ubo->gl);
-    glBufferSubData(GL_UNIFORM_BUFFER, start * stride, len * stride, ptr);
+    switch(ubo->mode) {
+        case LRBUFFERUPDATE_ORPHAN:
+            /* orphaning drops the whole store, respecify it from the copy */
+            GL_CHECK(ctx, glBufferData(GL_UNIFORM_BUFFER, ubo->copyStride, NULL, GL_STREAM_DRAW));
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, ubo->size * stride, ubo->shadow);
+            break;
+        case LRBUFFERUPDATE_MAPINVALIDATE:
+            MapWrite(ctx, ubo, ptr, offset, bytes, GL_MAP_INVALIDATE_RANGE_BIT);
+            break;
+        case LRBUFFERUPDATE_UNSYNCHRONIZED:
+            WriteUnsynchronized(ctx, ubo, ptr, offset, bytes);
+            break;
+        default:
+            glBufferSubData(GL_UNIFORM_BUFFER, offset, bytes, ptr);
+            break;
+    }
+}
+
+LREXPORT void LR_UniformBuffer_SetUpdateMode(LR_Context *ctx, LR_UniformBuffer *ubo, LRBUFFERUPDATE mode)
+{
+    LR_AssertTrue(ctx, mode >= 0 && mode < LRBUFFERUPDATE_COUNT);
+    if(ubo->mode == mode) return;
+    Allocate(ctx, ubo, mode);
 }
 
 LREXPORT void LR_UniformBuffer_Destroy(LR_Context *ctx, LR_UniformBuffer *ubo)
 {
     glDeleteBuffers(1, &ubo->gl);
+    free(ubo->shadow);
     free(ubo);
 }
\ No newline at end of file
@@ -2,11 +2,20 @@
 #define _LR_UBO_H_
 #include <lancerrender.h>
 #include <glad/glad.h>
+#include "lr_uniformring.h"
 
 struct LR_UniformBuffer {
     GLuint gl;
     int stride;
     int size;
     int align;
+    LRBUFFERUPDATE mode;
+    void *shadow; //full copy of the contents
+    /* LRBUFFERUPDATE_UNSYNCHRONIZED keeps LR_RING_SEGMENTS copies. Writes go
+     * to a copy no frame in flight reads, draws bind the newest */
+    int copies;
+    int copyStride; //bytes, aligned for glBindBufferRange
+    int current;
+    int readFrame[LR_RING_SEGMENTS]; //last frame a draw bound each copy
 };
-#endif
\ No newline at end of file
+#endif
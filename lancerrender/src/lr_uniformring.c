@@ -0,0 +1,103 @@
+#include "lr_uniformring.h"
+#include "lr_context.h"
+#include "lr_errors.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* fences are kept across growth, LR_BeginFrame still waits on them so
+ * uniform buffers can rely on how far behind the GPU is */
+static void AllocateStorage(LR_Context *ctx, LR_UniformRing *ring)
+{
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring->gl);
+    GL_CHECK(ctx, glBufferData(GL_COPY_WRITE_BUFFER, ring->segmentSize * LR_RING_SEGMENTS + ring->slack, NULL, GL_STREAM_DRAW));
+    ring->uploaded = 0;
+}
+
+void LR_UniformRing_Init(LR_Context *ctx, LR_UniformRing *ring, int segmentSize, int slack)
+{
+    memset(ring, 0, sizeof(LR_UniformRing));
+    ring->segmentSize = segmentSize;
+    ring->slack = slack;
+    ring->data = malloc(segmentSize);
+    GL_CHECK(ctx, glGenBuffers(1, &ring->gl));
+    AllocateStorage(ctx, ring);
+}
+
+void LR_UniformRing_Destroy(LR_Context *ctx, LR_UniformRing *ring)
+{
+    for(int i = 0; i < LR_RING_SEGMENTS; i++) {
+        if(ring->fences[i]) glDeleteSync(ring->fences[i]);
+    }
+    glDeleteBuffers(1, &ring->gl);
+    free(ring->data);
+}
+
+void LR_UniformRing_BeginFrame(LR_Context *ctx, LR_UniformRing *ring)
+{
+    ring->segment = (ring->segment + 1) % LR_RING_SEGMENTS;
+    GLsync fence = ring->fences[ring->segment];
+    if(fence) {
+        /* only blocks if the GPU is more than LR_RING_SEGMENTS frames behind */
+        GLenum res;
+        do {
+            res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while(res == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        ring->fences[ring->segment] = 0;
+    }
+    ring->dataPtr = 0;
+    ring->uploaded = 0;
+}
+
+void LR_UniformRing_EndFrame(LR_Context *ctx, LR_UniformRing *ring)
+{
+    LR_AssertTrue(ctx, !ring->fences[ring->segment]);
+    ring->fences[ring->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+int LR_UniformRing_Alloc(LR_Context *ctx, LR_UniformRing *ring, int size, int align)
+{
+    int offset = ring->dataPtr;
+    if(align > 1) offset = ((offset + (align - 1)) / align) * align;
+    if(offset + size > ring->segmentSize) {
+        /* grow: offsets are frame-relative so recorded commands stay valid,
+         * the whole frame is re-uploaded into the new storage */
+        int newSize = ring->segmentSize;
+        while(newSize < offset + size) newSize *= 2;
+        ring->data = realloc(ring->data, newSize);
+        ring->segmentSize = newSize;
+        AllocateStorage(ctx, ring);
+    }
+    ring->dataPtr = offset + size;
+    return offset;
+}
+
+void LR_UniformRing_Upload(LR_Context *ctx, LR_UniformRing *ring)
+{
+    if(ring->uploaded >= ring->dataPtr) return;
+    int base = ring->segment * ring->segmentSize;
+    int len = ring->dataPtr - ring->uploaded;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ring->gl);
+    /* segment is fenced, the GPU is not reading this range */
+    void *dst = glMapBufferRange(
+        GL_COPY_WRITE_BUFFER,
+        base + ring->uploaded,
+        len,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+    );
+    if(!dst) {
+        LR_CriticalErrorFunc(ctx, "LR_UniformRing_Upload: glMapBufferRange failed");
+        return;
+    }
+    memcpy(dst, LR_UniformRing_Ptr(ring, ring->uploaded), len);
+    GL_CHECK(ctx, glUnmapBuffer(GL_COPY_WRITE_BUFFER));
+    ring->uploaded = ring->dataPtr;
+}
+
+void LR_UniformRing_Bind(LR_Context *ctx, LR_UniformRing *ring, int index, int offset, int size)
+{
+    int start = ring->segment * ring->segmentSize + offset;
+    int total = ring->segmentSize * LR_RING_SEGMENTS + ring->slack;
+    if(start + size > total) size = total - start;
+    LR_BindUniformRange(ctx, index, ring->gl, start, size);
+}
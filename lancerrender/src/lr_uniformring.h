@@ -0,0 +1,39 @@
+#ifndef _LR_UNIFORMRING_H_
+#define _LR_UNIFORMRING_H_
+#include <lancerrender.h>
+#include <glad/glad.h>
+
+/*
+ * Per-frame uniform data, built up on the CPU during the frame and
+ * uploaded into one segment of a triple-buffered UBO before each flush.
+ * Offsets returned by LR_UniformRing_Alloc are relative to the frame, the
+ * segment base is added when binding so the buffer can grow mid-frame.
+ */
+#define LR_RING_SEGMENTS (3)
+
+typedef struct LR_UniformRing {
+    GLuint gl;
+    int segmentSize;
+    int slack;
+    int segment;
+    void *data;
+    int dataPtr;
+    int uploaded;
+    GLsync fences[LR_RING_SEGMENTS];
+} LR_UniformRing;
+
+void LR_UniformRing_Init(LR_Context *ctx, LR_UniformRing *ring, int segmentSize, int slack);
+void LR_UniformRing_Destroy(LR_Context *ctx, LR_UniformRing *ring);
+/* returns once the frame LR_RING_SEGMENTS before the new one has completed */
+void LR_UniformRing_BeginFrame(LR_Context *ctx, LR_UniformRing *ring);
+void LR_UniformRing_EndFrame(LR_Context *ctx, LR_UniformRing *ring);
+/* returns frame-relative offset of size bytes, aligned to align */
+int LR_UniformRing_Alloc(LR_Context *ctx, LR_UniformRing *ring, int size, int align);
+/* uploads everything allocated since the last call */
+void LR_UniformRing_Upload(LR_Context *ctx, LR_UniformRing *ring);
+/* binds size bytes at frame-relative offset to a uniform buffer binding point */
+void LR_UniformRing_Bind(LR_Context *ctx, LR_UniformRing *ring, int index, int offset, int size);
+
+#define LR_UniformRing_Ptr(ring, offset) ((void*)((char*)(ring)->data + (offset)))
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <lancerrender.h>
+#include <lancerrender_mesh.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include "obj.h"
+
+struct CookOptions {
+    bool pack = false;
+    bool optimize = true;
+    int benchRuns = 0;
+};
+
+struct Bounds {
+    float min[3];
+    float max[3];
+    float sphere[4];
+};
+
+static std::string ReadFile(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if(!f) throw std::runtime_error(std::string("cannot open ") + path);
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    std::string text((size_t)len, '\0');
+    size_t read = fread(&text[0], 1, (size_t)len, f);
+    fclose(f);
+    if(read != (size_t)len) throw std::runtime_error(std::string("cannot read ") + path);
+    return text;
+}
+
+static double Milliseconds()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t Align(uint64_t offset)
+{
+    return (offset + LR_MESHFILE_ALIGN - 1) & ~(uint64_t)(LR_MESHFILE_ALIGN - 1);
+}
+
+/* AABB of the referenced vertices, the sphere is centred on it */
+static void ComputeBounds(const ObjMesh& mesh, const uint32_t *indices, size_t count, Bounds& b)
+{
+    for(int k = 0; k < 3; k++) {
+        b.min[k] = count ? INFINITY : 0;
+        b.max[k] = count ? -INFINITY : 0;
+    }
+    for(size_t i = 0; i < count; i++) {
+        const float *p = mesh.vertices[indices[i]].position;
+        for(int k = 0; k < 3; k++) {
+            if(p[k] < b.min[k]) b.min[k] = p[k];
+            if(p[k] > b.max[k]) b.max[k] = p[k];
+        }
+    }
+    float r2 = 0;
+    for(int k = 0; k < 3; k++) b.sphere[k] = (b.min[k] + b.max[k]) * 0.5f;
+    for(size_t i = 0; i < count; i++) {
+        const float *p = mesh.vertices[indices[i]].position;
+        float dx = p[0] - b.sphere[0], dy = p[1] - b.sphere[1], dz = p[2] - b.sphere[2];
+        float d = dx * dx + dy * dy + dz * dz;
+        if(d > r2) r2 = d;
+    }
+    b.sphere[3] = sqrtf(r2);
+}
+
+static void AddElement(LR_MeshFileHeader& h, LRELEMENTSLOT slot, LRELEMENTTYPE type, int elements, int normalized, int size)
+{
+    LR_MeshFileElement& e = h.elements[h.elementCount++];
+    e.slot = (uint8_t)slot;
+    e.type = (uint8_t)type;
+    e.elements = (uint8_t)elements;
+    e.normalized = (uint8_t)normalized;
+    e.offset = h.vertexStride;
+    h.vertexStride += size;
+}
+
+/* position is always float3. --pack stores normals as 2_10_10_10 and
+ * texcoords as half floats, the layout the testapp uses */
+static void BuildLayout(const ObjMesh& mesh, const CookOptions& opts, LR_MeshFileHeader& h)
+{
+    AddElement(h, LRELEMENTSLOT_POSITION, LRELEMENTTYPE_FLOAT, 3, 0, 12);
+    if(mesh.hasNormals) {
+        if(opts.pack) AddElement(h, LRELEMENTSLOT_NORMAL, LRELEMENTTYPE_INT_2_10_10_10_REV, 4, 1, 4);
+        else AddElement(h, LRELEMENTSLOT_NORMAL, LRELEMENTTYPE_FLOAT, 3, 0, 12);
+    }
+    if(mesh.hasTexcoords) {
+        if(opts.pack) AddElement(h, LRELEMENTSLOT_TEXTURE1, LRELEMENTTYPE_HALF_FLOAT, 2, 0, 4);
+        else AddElement(h, LRELEMENTSLOT_TEXTURE1, LRELEMENTTYPE_FLOAT, 2, 0, 8);
+    }
+}
+
+static void WriteVertex(char *dst, const ObjVertex& v, const ObjMesh& mesh, const CookOptions& opts)
+{
+    memcpy(dst, v.position, 12);
+    dst += 12;
+    if(mesh.hasNormals) {
+        if(opts.pack) {
+            uint32_t n = LR_PackSnorm1010102(v.normal[0], v.normal[1], v.normal[2], 0);
+            memcpy(dst, &n, 4);
+            dst += 4;
+        } else {
+            memcpy(dst, v.normal, 12);
+            dst += 12;
+        }
+    }
+    if(mesh.hasTexcoords) {
+        if(opts.pack) {
+            uint16_t uv[2] = { LR_FloatToHalf(v.uv[0]), LR_FloatToHalf(v.uv[1]) };
+            memcpy(dst, uv, 4);
+        } else {
+            memcpy(dst, v.uv, 8);
+        }
+    }
+}
+
+static void WritePadding(FILE *f, uint64_t from, uint64_t to)
+{
+    static const char zero[LR_MESHFILE_ALIGN] = { 0 };
+    if(to > from) fwrite(zero, 1, (size_t)(to - from), f);
+}
+
+static void Cook(const ObjMesh& mesh, const CookOptions& opts, const char *outPath)
+{
+    LR_MeshFileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = LR_MESHFILE_MAGIC;
+    h.version = LR_MESHFILE_VERSION;
+    BuildLayout(mesh, opts, h);
+    h.vertexCount = (uint32_t)mesh.vertices.size();
+    h.indexType = h.vertexCount <= 65536 ? LRINDEXTYPE_USHORT : LRINDEXTYPE_UINT;
+    //one index range per material
+    std::vector<uint32_t> indices;
+    std::vector<LR_MeshFileSubmesh> submeshes;
+    for(auto& g : mesh.groups) {
+        if(g.indices.empty()) continue;
+        LR_MeshFileSubmesh sub;
+        memset(&sub, 0, sizeof(sub));
+        strncpy(sub.name, g.material.c_str(), LR_MESHFILE_NAMELENGTH - 1);
+        sub.startIndex = (uint32_t)indices.size();
+        sub.indexCount = (uint32_t)g.indices.size();
+        Bounds b;
+        ComputeBounds(mesh, g.indices.data(), g.indices.size(), b);
+        memcpy(sub.boundsMin, b.min, sizeof(b.min));
+        memcpy(sub.boundsMax, b.max, sizeof(b.max));
+        memcpy(sub.sphere, b.sphere, sizeof(b.sphere));
+        indices.insert(indices.end(), g.indices.begin(), g.indices.end());
+        submeshes.push_back(sub);
+    }
+    h.indexCount = (uint32_t)indices.size();
+    h.submeshCount = (uint32_t)submeshes.size();
+    Bounds b;
+    ComputeBounds(mesh, indices.data(), indices.size(), b);
+    memcpy(h.boundsMin, b.min, sizeof(b.min));
+    memcpy(h.boundsMax, b.max, sizeof(b.max));
+    memcpy(h.sphere, b.sphere, sizeof(b.sphere));
+
+    std::vector<char> vertexData((size_t)h.vertexCount * h.vertexStride);
+    for(size_t i = 0; i < mesh.vertices.size(); i++)
+        WriteVertex(&vertexData[i * h.vertexStride], mesh.vertices[i], mesh, opts);
+    int indexSize = h.indexType == LRINDEXTYPE_UINT ? 4 : 2;
+    std::vector<char> indexData((size_t)h.indexCount * indexSize);
+    for(size_t i = 0; i < indices.size(); i++) {
+        if(h.indexType == LRINDEXTYPE_UINT) ((uint32_t*)indexData.data())[i] = indices[i];
+        else ((uint16_t*)indexData.data())[i] = (uint16_t)indices[i];
+    }
+    if(opts.optimize) {
+        LRINDEXTYPE type = (LRINDEXTYPE)h.indexType;
+        for(auto& sub : submeshes) {
+            LR_VertexCacheStats stats;
+            const char *name = sub.name[0] ? sub.name : "(default)";
+            if(!LR_OptimizeVertexCache(&indexData[(size_t)sub.startIndex * indexSize], type, sub.indexCount, h.vertexCount, &stats)) {
+                fprintf(stderr, "warning: %s: vertex cache optimisation failed, keeping triangle order\n", name);
+                continue;
+            }
+            printf("%s: ACMR %.3f -> %.3f\n", name, stats.acmrBefore, stats.acmrAfter);
+        }
+        LR_OptimizeVertexFetch(vertexData.data(), h.vertexStride, h.vertexCount, indexData.data(), type, h.indexCount);
+    }
+
+    h.submeshOffset = Align(sizeof(LR_MeshFileHeader));
+    h.vertexOffset = Align(h.submeshOffset + submeshes.size() * sizeof(LR_MeshFileSubmesh));
+    h.indexOffset = Align(h.vertexOffset + vertexData.size());
+    h.fileSize = h.indexOffset + indexData.size();
+    FILE *f = fopen(outPath, "wb");
+    if(!f) throw std::runtime_error(std::string("cannot write ") + outPath);
+    fwrite(&h, sizeof(h), 1, f);
+    WritePadding(f, sizeof(h), h.submeshOffset);
+    fwrite(submeshes.data(), sizeof(LR_MeshFileSubmesh), submeshes.size(), f);
+    WritePadding(f, h.submeshOffset + submeshes.size() * sizeof(LR_MeshFileSubmesh), h.vertexOffset);
+    fwrite(vertexData.data(), 1, vertexData.size(), f);
+    WritePadding(f, h.vertexOffset + vertexData.size(), h.indexOffset);
+    fwrite(indexData.data(), 1, indexData.size(), f);
+    bool failed = ferror(f) != 0;
+    fclose(f);
+    if(failed) throw std::runtime_error(std::string("error writing ") + outPath);
+    printf("%u vertices (%u bytes each), %u indices, %u submeshes, %llu bytes\n",
+        h.vertexCount, h.vertexStride, h.indexCount, h.submeshCount, (unsigned long long)h.fileSize);
+}
+
+/* Time from file to usable vertex/index data both ways, best of `runs`.
+ * Both files come from a warm page cache so this measures parsing, not
+ * disk. */
+static void Benchmark(const char *objPath, const char *cookedPath, int runs)
+{
+    double objBest = -1, cookedBest = -1;
+    size_t objBytes = 0, cookedBytes = 0;
+    uint32_t checksum = 0;
+    for(int i = 0; i < runs; i++) {
+        double start = Milliseconds();
+        std::string text = ReadFile(objPath);
+        ObjMesh mesh;
+        ParseObj(text.c_str(), text.size(), mesh);
+        double elapsed = Milliseconds() - start;
+        objBytes = text.size();
+        checksum += (uint32_t)mesh.vertices.size();
+        if(objBest < 0 || elapsed < objBest) objBest = elapsed;
+    }
+    for(int i = 0; i < runs; i++) {
+        double start = Milliseconds();
+        LRMeshFileResult res;
+        LR_MeshFile *mf = LR_MeshFile_Open(cookedPath, &res);
+        if(!mf) throw std::runtime_error("cannot open cooked mesh");
+        const LR_MeshFileHeader *h = LR_MeshFile_GetHeader(mf);
+        //read every byte like an upload would
+        const uint32_t *v = (const uint32_t*)LR_MeshFile_GetVertices(mf);
+        size_t len = (size_t)(h->fileSize - h->vertexOffset) / 4;
+        for(size_t j = 0; j < len; j++) checksum += v[j];
+        cookedBytes = (size_t)h->fileSize;
+        LR_MeshFile_Close(mf);
+        double elapsed = Milliseconds() - start;
+        if(cookedBest < 0 || elapsed < cookedBest) cookedBest = elapsed;
+    }
+    printf("obj:    %8.2f ms %9.1f MB/s (%zu bytes)\n", objBest, objBytes / (objBest * 1000.0), objBytes);
+    printf("cooked: %8.2f ms %9.1f MB/s (%zu bytes)\n", cookedBest, cookedBytes / (cookedBest * 1000.0), cookedBytes);
+    printf("load time %.1fx faster (checksum %u)\n", objBest / cookedBest, checksum);
+}
+
+static void Usage()
+{
+    fprintf(stderr, "Usage: lrmeshcook [--pack] [--no-optimize] [--bench runs] input.obj output.lrm\n");
+    fprintf(stderr, "  --pack         2_10_10_10 normals and half float texture coordinates\n");
+    fprintf(stderr, "  --no-optimize  keep the OBJ triangle and vertex order\n");
+    fprintf(stderr, "  --bench runs   compare loading the output with parsing the input\n");
+}
+
+int main(int argc, char **argv)
+{
+    CookOptions opts;
+    std::vector<const char*> files;
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--pack")) {
+            opts.pack = true;
+        } else if(!strcmp(argv[i], "--no-optimize")) {
+            opts.optimize = false;
+        } else if(!strcmp(argv[i], "--bench") && i + 1 < argc) {
+            opts.benchRuns = atoi(argv[++i]);
+        } else if(argv[i][0] == '-') {
+            Usage();
+            return 2;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if(files.size() != 2) {
+        Usage();
+        return 2;
+    }
+    try
+    {
+        std::string text = ReadFile(files[0]);
+        ObjMesh mesh;
+        ParseObj(text.c_str(), text.size(), mesh);
+        Cook(mesh, opts, files[1]);
+        if(opts.benchRuns > 0) Benchmark(files[0], files[1], opts.benchRuns);
+    }
+    catch(const std::exception& e)
+    {
+        fprintf(stderr, "%s: %s\n", files[0], e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "obj.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <unordered_map>
+
+struct VertexKey {
+    int position;
+    int texcoord;
+    int normal;
+    bool operator==(const VertexKey& other) const {
+        return position == other.position && texcoord == other.texcoord && normal == other.normal;
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey& k) const {
+        uint64_t h = (uint64_t)(uint32_t)k.position * 0x9E3779B97F4A7C15ULL;
+        h ^= (uint64_t)(uint32_t)k.texcoord * 0xC2B2AE3D27D4EB4FULL;
+        h ^= (uint64_t)(uint32_t)k.normal * 0x165667B19E3779F9ULL;
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+
+struct ObjParser {
+    const char *p;
+    const char *end;
+    int line = 1;
+    std::vector<float> positions;
+    std::vector<float> texcoords;
+    std::vector<float> normals;
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertexMap;
+
+    [[noreturn]] void Fail(const char *msg) {
+        throw std::runtime_error("line " + std::to_string(line) + ": " + msg);
+    }
+    void SkipSpace() {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    }
+    void SkipLine() {
+        while(p < end && *p != '\n') p++;
+        if(p < end) {
+            p++;
+            line++;
+        }
+    }
+    bool AtLineEnd() {
+        SkipSpace();
+        return p >= end || *p == '\n' || *p == '#';
+    }
+    float ReadFloat() {
+        SkipSpace();
+        char *next;
+        float f = strtof(p, &next);
+        if(next == p) Fail("expected number");
+        p = next;
+        return f;
+    }
+    int ReadIndex(size_t count, int stride) {
+        char *next;
+        long i = strtol(p, &next, 10);
+        if(next == p) Fail("expected index");
+        p = next;
+        long n = (long)(count / stride);
+        //negative indices are relative to the end
+        long resolved = i < 0 ? n + i : i - 1;
+        if(resolved < 0 || resolved >= n) Fail("index out of range");
+        return (int)resolved;
+    }
+    uint32_t ReadVertex(ObjMesh& mesh) {
+        VertexKey key = { ReadIndex(positions.size(), 3), -1, -1 };
+        if(p < end && *p == '/') {
+            p++;
+            if(p < end && *p != '/') key.texcoord = ReadIndex(texcoords.size(), 2);
+            if(p < end && *p == '/') {
+                p++;
+                key.normal = ReadIndex(normals.size(), 3);
+            }
+        }
+        auto it = vertexMap.find(key);
+        if(it != vertexMap.end()) return it->second;
+        ObjVertex v;
+        memcpy(v.position, &positions[key.position * 3], 3 * sizeof(float));
+        if(key.normal >= 0) {
+            memcpy(v.normal, &normals[key.normal * 3], 3 * sizeof(float));
+            mesh.hasNormals = true;
+        } else {
+            v.normal[0] = v.normal[1] = v.normal[2] = 0;
+        }
+        if(key.texcoord >= 0) {
+            memcpy(v.uv, &texcoords[key.texcoord * 2], 2 * sizeof(float));
+            mesh.hasTexcoords = true;
+        } else {
+            v.uv[0] = v.uv[1] = 0;
+        }
+        uint32_t index = (uint32_t)mesh.vertices.size();
+        mesh.vertices.push_back(v);
+        vertexMap[key] = index;
+        return index;
+    }
+};
+
+void ParseObj(const char *text, size_t length, ObjMesh& mesh)
+{
+    ObjParser parser;
+    parser.p = text;
+    parser.end = text + length;
+    std::unordered_map<std::string, size_t> groupMap;
+    //index into mesh.groups, emplace_back may move them
+    size_t group = (size_t)-1;
+    std::vector<uint32_t> face;
+    while(parser.p < parser.end) {
+        parser.SkipSpace();
+        const char *p = parser.p;
+        size_t left = parser.end - p;
+        if(left >= 2 && p[0] == 'v' && p[1] == ' ') {
+            parser.p += 2;
+            for(int i = 0; i < 3; i++) parser.positions.push_back(parser.ReadFloat());
+        } else if(left >= 3 && p[0] == 'v' && p[1] == 't' && p[2] == ' ') {
+            parser.p += 3;
+            for(int i = 0; i < 2; i++) parser.texcoords.push_back(parser.ReadFloat());
+        } else if(left >= 3 && p[0] == 'v' && p[1] == 'n' && p[2] == ' ') {
+            parser.p += 3;
+            for(int i = 0; i < 3; i++) parser.normals.push_back(parser.ReadFloat());
+        } else if(left >= 2 && p[0] == 'f' && p[1] == ' ') {
+            parser.p += 2;
+            face.clear();
+            while(!parser.AtLineEnd()) face.push_back(parser.ReadVertex(mesh));
+            if(face.size() < 3) parser.Fail("face with fewer than 3 vertices");
+            if(group == (size_t)-1) {
+                auto it = groupMap.find("");
+                if(it == groupMap.end()) {
+                    it = groupMap.emplace("", mesh.groups.size()).first;
+                    mesh.groups.emplace_back();
+                }
+                group = it->second;
+            }
+            auto& indices = mesh.groups[group].indices;
+            for(size_t i = 2; i < face.size(); i++) {
+                indices.push_back(face[0]);
+                indices.push_back(face[i - 1]);
+                indices.push_back(face[i]);
+            }
+        } else if(left >= 7 && !strncmp(p, "usemtl", 6) && (p[6] == ' ' || p[6] == '\t')) {
+            parser.p += 7;
+            parser.SkipSpace();
+            const char *start = parser.p;
+            while(parser.p < parser.end && *parser.p != '\n' && *parser.p != '\r') parser.p++;
+            std::string name(start, parser.p);
+            auto it = groupMap.find(name);
+            if(it == groupMap.end()) {
+                it = groupMap.emplace(name, mesh.groups.size()).first;
+                mesh.groups.emplace_back();
+                mesh.groups.back().material = name;
+            }
+            group = it->second;
+        }
+        //everything else (o, g, s, mtllib, comments) is ignored
+        parser.SkipLine();
+    }
+    if(mesh.vertices.empty()) throw std::runtime_error("no faces");
+}
@@ -0,0 +1,31 @@
+#ifndef _OBJ_H_
+#define _OBJ_H_
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct ObjVertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+
+/* triangles sharing a usemtl material */
+struct ObjGroup {
+    std::string material;
+    std::vector<uint32_t> indices;
+};
+
+struct ObjMesh {
+    std::vector<ObjVertex> vertices;
+    std::vector<ObjGroup> groups;
+    bool hasNormals = false;
+    bool hasTexcoords = false;
+};
+
+/* Parses NUL terminated OBJ text. Polygons are triangulated as fans and
+ * identical position/texcoord/normal triples share one vertex.
+ * Throws std::runtime_error on malformed input. */
+void ParseObj(const char *text, size_t length, ObjMesh& mesh);
+
+#endif
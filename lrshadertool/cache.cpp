@@ -0,0 +1,124 @@
+#include "cache.h"
+#include "platform.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+
+static uint64_t Fnv1a64(const std::string& str, uint64_t hash)
+{
+    for(size_t i = 0; i < str.size(); i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+ShaderCache::ShaderCache(const std::string& dir) : dir(dir), hits(0), misses(0), writeFailures(0), bytesRead(0), bytesWritten(0)
+{
+    MakeDirectory(dir);
+}
+
+std::string ShaderCache::Key(const std::string& source, const std::string& defines, const std::string& options, bool vertex)
+{
+    std::string material = LRSHADERTOOL_VERSION;
+    material += '\0';
+    material += vertex ? "vertex" : "fragment";
+    material += '\0';
+    material += options;
+    material += '\0';
+    material += defines;
+    material += '\0';
+    material += source;
+    /* two differently seeded 64-bit hashes make an accidental collision
+     * negligible, the header line in each file guards against the rest */
+    uint64_t a = Fnv1a64(material, 14695981039346656037ULL);
+    uint64_t b = Fnv1a64(material, 0x84222325cbf29ce4ULL ^ (uint64_t)material.size());
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)a, (unsigned long long)b);
+    return std::string(buf);
+}
+
+std::string ShaderCache::Path(const std::string& key)
+{
+    return dir + "/" + key + ".glsl";
+}
+
+static std::string HeaderLine(const std::string& key)
+{
+    return "lrshadertool-cache " LRSHADERTOOL_VERSION " " + key + "\n";
+}
+
+/* file: header line, reflection lines, "--" line, GLSL */
+bool ShaderCache::Get(const std::string& key, std::string& glsl, std::string& reflection)
+{
+    std::ifstream in(Path(key).c_str(), std::ios::binary);
+    if(!in.is_open()) {
+        misses++;
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string contents = ss.str();
+    std::string header = HeaderLine(key);
+    if(contents.compare(0, header.size(), header) != 0) {
+        misses++;
+        return false;
+    }
+    size_t sep = contents.compare(header.size(), 3, "--\n") == 0 ?
+        header.size() : contents.find("\n--\n", header.size());
+    if(sep == std::string::npos) {
+        misses++;
+        return false;
+    }
+    if(sep != header.size()) sep++; //keep the newline ending the last record
+    reflection = contents.substr(header.size(), sep - header.size());
+    glsl = contents.substr(sep + 3);
+    hits++;
+    bytesRead += (long long)contents.size();
+    return true;
+}
+
+void ShaderCache::Put(const std::string& key, const std::string& glsl, const std::string& reflection)
+{
+    /* write to a name private to this process and thread then rename, so
+     * concurrent builds sharing the directory never see a partial file */
+    std::string path = Path(key);
+    std::ostringstream tmpName;
+    tmpName << path << ".tmp" << ProcessId() << "." << std::hash<std::thread::id>()(std::this_thread::get_id());
+    std::string tmp = tmpName.str();
+    std::string header = HeaderLine(key);
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary);
+        if(!out.is_open()) {
+            writeFailures++;
+            return;
+        }
+        out << header << reflection << "--\n" << glsl;
+        if(!out.good()) {
+            writeFailures++;
+            out.close();
+            remove(tmp.c_str());
+            return;
+        }
+    }
+    if(rename(tmp.c_str(), path.c_str()) != 0) {
+        /* another process got there first */
+        remove(tmp.c_str());
+        return;
+    }
+    bytesWritten += (long long)(header.size() + reflection.size() + 3 + glsl.size());
+}
+
+void ShaderCache::PrintStats(FILE *out)
+{
+    int h = hits;
+    int m = misses;
+    int total = h + m;
+    fprintf(out, "cache: %d hits, %d misses (%.1f%% hit rate)\n", h, m, total ? (100.0 * h / total) : 0.0);
+    fprintf(out, "cache: %lld bytes read, %lld bytes written", (long long)bytesRead, (long long)bytesWritten);
+    if(writeFailures) fprintf(out, ", %d writes failed", (int)writeFailures);
+    fprintf(out, "\n");
+}
@@ -0,0 +1,31 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <string>
+#include <atomic>
+#include <stdio.h>
+
+/* Bump when a change to the tool alters the GLSL it emits */
+#define LRSHADERTOOL_VERSION "2"
+
+/* Content-addressed store of final GLSL, one file per compiled stage */
+class ShaderCache {
+    public:
+        ShaderCache(const std::string& dir);
+        /* key covers the tool version, stage, output options, define block
+         * and preprocessed source */
+        static std::string Key(const std::string& source, const std::string& defines, const std::string& options, bool vertex);
+        bool Get(const std::string& key, std::string& glsl, std::string& reflection);
+        void Put(const std::string& key, const std::string& glsl, const std::string& reflection);
+        void PrintStats(FILE *out);
+    private:
+        std::string dir;
+        std::string Path(const std::string& key);
+        std::atomic<int> hits;
+        std::atomic<int> misses;
+        std::atomic<int> writeFailures;
+        std::atomic<long long> bytesRead;
+        std::atomic<long long> bytesWritten;
+};
+
+#endif
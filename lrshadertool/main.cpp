@@ -18,17 +18,30 @@
 #include "miniz.h"
 #include "shfile.h"
 #include "platform.h"
+#include "cache.h"
+#include "minify.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
-
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+/* Lighting and Camera are left as real blocks, the runtime
+ * binds them from its per-frame uniform buffer */
 const char* flattenBlocks[] = {
     "vs_Material",
     "fs_Material",
-    "Lighting",
 };
 
+/* --minify: strip inactive declarations and minify the emitted GLSL */
+static bool minifyOutput = false;
+static std::atomic<long long> minifyBytesIn(0);
+static std::atomic<long long> minifyBytesOut(0);
+
 static int DoFlatten(const char *name) {
     for(int i = 0; i < sizeof(flattenBlocks) / sizeof(const char*); i++) {
         if(!strcmp(name, flattenBlocks[i]))
@@ -37,7 +50,42 @@ static int DoFlatten(const char *name) {
     return 0;
 }
 
-int ToGLSL(std::vector<uint32_t>& spirv_binary, std::string& outstr)
+/* One line per resource the stage actually reads:
+ *   a <attribute>, u <uniform> [flattened size], b <block> <size>, s <sampler>
+ * Units are appended to sampler lines when a variant's stages are merged. */
+static std::string Reflect(spirv_cross::CompilerGLSL& glsl, bool vertex)
+{
+    std::ostringstream out;
+    auto active = glsl.get_active_interface_variables();
+    spirv_cross::ShaderResources res = glsl.get_shader_resources(active);
+    if(vertex) {
+        for(auto &input : res.stage_inputs)
+            out << "a " << input.name << "\n";
+    }
+    for(auto &ubo : res.uniform_buffers) {
+        size_t size = glsl.get_declared_struct_size(glsl.get_type(ubo.base_type_id));
+        out << (DoFlatten(ubo.name.c_str()) ? "u " : "b ") << ubo.name << " " << size << "\n";
+    }
+    for(auto &img : res.sampled_images)
+        out << "s " << img.name << "\n";
+    /* default block uniforms are not part of ShaderResources */
+    std::vector<std::string> loose;
+    for(auto id : active) {
+        if(glsl.get_storage_class(id) != spv::StorageClassUniformConstant) continue;
+        auto &type = glsl.get_type_from_variable(id);
+        if(type.basetype == spirv_cross::SPIRType::SampledImage ||
+            type.basetype == spirv_cross::SPIRType::Image ||
+            type.basetype == spirv_cross::SPIRType::Sampler) continue;
+        loose.push_back(glsl.get_name(id));
+    }
+    /* active variables come from a hash set, sort for stable output */
+    std::sort(loose.begin(), loose.end());
+    for(auto &name : loose)
+        out << "u " << name << "\n";
+    return out.str();
+}
+
+int ToGLSL(std::vector<uint32_t>& spirv_binary, std::string& outstr, std::string& reflection, bool vertex)
 {
     try
     {
@@ -48,6 +96,11 @@ int ToGLSL(std::vector<uint32_t>& spirv_binary, std::string& outstr)
                 glsl.flatten_buffer_block(ubo.id);
             }
         }
+        reflection = Reflect(glsl, vertex);
+        if(minifyOutput) {
+            /* only declare what this permutation reads or writes */
+            glsl.set_enabled_interface_variables(glsl.get_active_interface_variables());
+        }
 
         spirv_cross::CompilerGLSL::Options options;
         options.version = 150;
@@ -58,6 +111,11 @@ int ToGLSL(std::vector<uint32_t>& spirv_binary, std::string& outstr)
         std::string source = glsl.compile();
         source.erase(0, source.find("\n") + 1); //remove version directive
         outstr = "#ifdef GL_ES\nprecision highp float;\nprecision highp int;\n#endif\n" + source;
+        if(minifyOutput) {
+            minifyBytesIn += (long long)outstr.size();
+            outstr = MinifyGLSL(outstr);
+            minifyBytesOut += (long long)outstr.size();
+        }
         return 1;
     }
     catch(const std::exception& e)
@@ -67,39 +125,138 @@ int ToGLSL(std::vector<uint32_t>& spirv_binary, std::string& outstr)
     }    
 }
 
-static void IntPermute(std::vector<int> flags, std::vector<int>& ret)
+struct FeaturePair {
+    std::vector<std::string> strings;
+    int flags;
+};
+
+typedef std::vector<FeaturePair> StringVectorVector;
+
+/* Feature list file: one feature per line, line order gives the bit.
+ * Directives restrict which combinations are generated:
+ *   @exclusive A B C   at most one of A, B, C
+ *   @requires A B C    A is only enabled together with B and C
+ *   @allow A B         allow-list entry, if any are present only the listed
+ *                      combinations (and no features) are built
+ * Lines starting with # are comments. */
+struct FeatureList {
+    std::vector<std::string> names;
+    std::vector<int> exclusive;
+    std::vector<std::pair<int,int>> dependencies; /* (feature, features it requires) */
+    std::vector<int> allow;
+};
+
+static std::vector<std::string> SplitWords(const std::string& line)
+{
+    std::istringstream ss(line);
+    std::vector<std::string> words;
+    std::string w;
+    while(ss >> w) words.push_back(w);
+    return words;
+}
+
+static int ParseFeatureList(const char *path, FeatureList& fl)
 {
-    std::vector<int> valsinv;
-    for (auto x : flags) {
-        valsinv.push_back(~x);
-    }
-    int max = 0;
-    for (auto x : flags) max |= x;
-    for(int i = 0; i <= max; i++) {
-        int unaccountedBits = i;
-        for(auto x : valsinv) {
-            unaccountedBits &= x;
-            if(unaccountedBits == 0) {
-                if(i != 0)
-                    ret.push_back(i);
-                break;
+    std::istringstream flist(ReadAllText(path));
+    std::string nextLine;
+    std::vector<std::vector<std::string>> directives;
+    while(std::getline(flist, nextLine)) {
+        std::vector<std::string> words = SplitWords(nextLine);
+        if(!words.size() || words[0][0] == '#') continue;
+        if(words[0][0] == '@') {
+            directives.push_back(words);
+        } else {
+            if(words.size() > 1) {
+                fprintf(stderr, "%s: feature names cannot contain spaces `%s`\n", path, nextLine.c_str());
+                return 0;
             }
+            fl.names.push_back(words[0]);
         }
     }
+    if(fl.names.size() > 31) {
+        fprintf(stderr, "%s: too many features (max 31)\n", path);
+        return 0;
+    }
+    for(auto& d : directives) {
+        int mask = 0;
+        int first = 0;
+        for(int i = 1; i < d.size(); i++) {
+            auto pos = std::find(fl.names.begin(), fl.names.end(), d[i]);
+            if(pos == fl.names.end()) {
+                fprintf(stderr, "%s: unknown feature `%s` in %s\n", path, d[i].c_str(), d[0].c_str());
+                return 0;
+            }
+            int bit = 1 << (int)std::distance(fl.names.begin(), pos);
+            if(i == 1) first = bit;
+            else mask |= bit;
+        }
+        if(d[0] == "@exclusive") {
+            fl.exclusive.push_back(mask | first);
+        } else if (d[0] == "@requires") {
+            if(!first || !mask) {
+                fprintf(stderr, "%s: @requires needs a feature and its dependencies\n", path);
+                return 0;
+            }
+            fl.dependencies.push_back(std::make_pair(first, mask));
+        } else if (d[0] == "@allow") {
+            fl.allow.push_back(mask | first);
+        } else {
+            fprintf(stderr, "%s: unknown directive %s\n", path, d[0].c_str());
+            return 0;
+        }
+    }
+    return 1;
 }
 
-struct FeaturePair {
-    std::vector<std::string> strings;
-    int flags;
-};
+static bool ValidCombination(const FeatureList *fl, int c)
+{
+    if(!fl) return true;
+    for(auto m : fl->exclusive) {
+        int x = c & m;
+        if(x & (x - 1)) return false;
+    }
+    for(auto& r : fl->dependencies) {
+        if((c & r.first) && (c & r.second) != r.second) return false;
+    }
+    return true;
+}
 
-typedef std::vector<FeaturePair> StringVectorVector;
+/* Depth-first over the shader's features, dropping a branch as soon as it
+ * breaks an exclusive group so invalid combinations are never visited */
+static void IntPermute(const std::vector<int>& flags, const FeatureList *fl, int idx, int c, std::vector<int>& ret)
+{
+    if(idx == flags.size()) {
+        if(c != 0 && ValidCombination(fl, c)) ret.push_back(c);
+        return;
+    }
+    IntPermute(flags, fl, idx + 1, c, ret);
+    int with = c | flags[idx];
+    if(fl) {
+        for(auto m : fl->exclusive) {
+            int x = with & m;
+            if(x & (x - 1)) return;
+        }
+    }
+    IntPermute(flags, fl, idx + 1, with, ret);
+}
 
-static StringVectorVector Permute(std::vector<std::string> defs, std::vector<int> flags)
+static StringVectorVector Permute(std::vector<std::string> defs, std::vector<int> flags, const FeatureList *fl)
 {
     std::vector<int> combos;
     StringVectorVector strcombos;
-    IntPermute(flags, combos);
+    if(fl && fl->allow.size()) {
+        int shaderMask = 0;
+        for(auto x : flags) shaderMask |= x;
+        for(auto a : fl->allow) {
+            /* entries may name features this shader lacks */
+            int c = a & shaderMask;
+            if(c && ValidCombination(fl, c)) combos.push_back(c);
+        }
+    } else {
+        IntPermute(flags, fl, 0, 0, combos);
+    }
+    std::sort(combos.begin(), combos.end());
+    combos.erase(std::unique(combos.begin(), combos.end()), combos.end());
     for (auto c : combos) {
         std::vector<std::string> strings;
         for(int i = 0; i < flags.size(); i++) {
@@ -131,18 +288,316 @@ struct CompiledShader {
     int flags;
     std::string vertex;
     std::string fragment;
+    std::string vertexReflection;
+    std::string fragmentReflection;
+    std::string reflection;
+};
+
+/* Union of both stages' records, samplers get units from 1 in order of
+ * appearance (unit 0 is reserved by the runtime) */
+static std::string MergeReflection(const std::string& vertex, const std::string& fragment)
+{
+    std::vector<std::string> lines;
+    std::istringstream vs(vertex + fragment);
+    std::string line;
+    while(std::getline(vs, line)) {
+        if(std::find(lines.begin(), lines.end(), line) == lines.end())
+            lines.push_back(line);
+    }
+    std::ostringstream out;
+    int unit = 1;
+    for(auto &l : lines) {
+        if(l.empty()) continue;
+        if(l[0] == 's') out << l << " " << unit++ << "\n";
+        else out << l << "\n";
+    }
+    return out.str();
+}
+
+struct CompileJob {
+    int flags;
+    std::string defines;
+};
+
+static int CompileStage(const std::string& source, const std::string& filename, const std::string& defines, bool vertex, std::string& out, std::string& reflection, ShaderCache *cache)
+{
+    std::string key;
+    if(cache) {
+        key = ShaderCache::Key(source, defines, minifyOutput ? "minify" : "", vertex);
+        if(cache->Get(key, out, reflection)) return 1;
+    }
+    std::vector<uint32_t> spv;
+    if(!CompileShader(source.c_str(), filename.c_str(), defines.c_str(), vertex, spv))
+        return 0;
+    if(!ToGLSL(spv, out, reflection, vertex))
+        return 0;
+    if(cache) cache->Put(key, out, reflection);
+    return 1;
+}
+
+static int CompilePermutation(ShFile& shader, const std::string& filename, const CompileJob& job, CompiledShader& out, ShaderCache *cache)
+{
+    const char *chars_def = job.defines.c_str();
+    const char *using_def = job.defines.size() ? "using " : "";
+    out.flags = job.flags;
+    if(!CompileStage(shader.vertex_source, filename, job.defines, true, out.vertex, out.vertexReflection, cache)) {
+        fprintf(stderr, "vertex shader compilation failed\n%s%s\n", using_def, chars_def);
+        return 0;
+    }
+    if(!CompileStage(shader.fragment_source, filename, job.defines, false, out.fragment, out.fragmentReflection, cache)) {
+        fprintf(stderr, "fragment shader compilation failed\n%s%s\n", using_def, chars_def);
+        return 0;
+    }
+    out.reflection = MergeReflection(out.vertexReflection, out.fragmentReflection);
+    return 1;
+}
+
+/* One input file and everything compiled from it */
+struct ShaderTarget {
+    std::string input;
+    std::string output;
+    std::string filename;
+    std::unique_ptr<ShFile> shader;
+    std::vector<CompileJob> jobs;
+    std::vector<CompiledShader> compiled;
 };
 
+/* Permutations of every target go into one queue so threads are kept busy
+ * across files. Results are stored by job index so the output does not
+ * depend on the order the threads finish in */
+static int CompileAll(std::vector<ShaderTarget>& targets, int threads, ShaderCache *cache)
+{
+    std::vector<std::pair<size_t, size_t>> work;
+    for(size_t t = 0; t < targets.size(); t++) {
+        targets[t].compiled.resize(targets[t].jobs.size());
+        for(size_t j = 0; j < targets[t].jobs.size(); j++)
+            work.push_back(std::make_pair(t, j));
+    }
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    auto worker = [&]() {
+        size_t i;
+        while(!failed && (i = next++) < work.size()) {
+            ShaderTarget& t = targets[work[i].first];
+            size_t j = work[i].second;
+            if(!CompilePermutation(*t.shader, t.filename, t.jobs[j], t.compiled[j], cache)) {
+                fprintf(stderr, "in %s\n", t.input.c_str());
+                failed = true;
+            }
+        }
+    };
+    if(threads > (int)work.size()) threads = (int)work.size();
+    if(threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> pool;
+        for(int i = 0; i < threads; i++) pool.emplace_back(worker);
+        for(auto& t: pool) t.join();
+    }
+    return !failed;
+}
+
+/* Flag assignment and the list of permutations to compile for a target */
+static int BuildJobs(ShaderTarget& target, const FeatureList *fl, int verbose)
+{
+    ShFile& shader = *target.shader;
+    std::vector<int> shFlags;
+    if(fl) {
+        /* sort features */
+        for(int i = 0; i < shader.features.size(); i++) {
+            auto pos = std::find(fl->names.begin(), fl->names.end(), shader.features[i]);
+            if(pos == fl->names.end()) {
+                fprintf(stderr, "Feature `%s` in file `%s` was not present in feature list\n", shader.features[i].c_str(), target.input.c_str());
+                return 0;
+            }
+            int index = std::distance( fl->names.begin(), pos );
+            if(verbose) {
+                fprintf(stderr, "Feature `%s`: flag 0x%x\n", shader.features[i].c_str(), 1 << index);
+            }
+            shFlags.push_back(1 << index);
+        }
+    } else {
+        for(int i = 0; i < shader.features.size(); i++) {
+            shFlags.push_back(1 << i);
+        }
+    }
+
+    StringVectorVector permutations = Permute(shader.features, shFlags, fl);
+    if(verbose) {
+        fprintf(stderr, "%s: %d of %d feature combinations are valid\n", target.filename.c_str(),
+            (int)permutations.size() + 1, 1 << (int)shFlags.size());
+    }
+    {
+        CompileJob zero;
+        zero.flags = 0;
+        target.jobs.push_back(zero);
+    }
+    if(verbose) fprintf(stderr, "Compiling without flags\n");
+    for(auto& x: permutations) {
+        //Print current flags
+        if(verbose) {
+            fprintf(stderr, "Compiling with 0x%x: ", x.flags);
+            int a = 0;
+            for(auto& s: x.strings) {
+                if(a) fprintf(stderr, ", ");
+                a = 1;
+                fprintf(stderr, "%s", s.c_str());
+            }
+            fprintf(stderr, "\n");
+        }
+        CompileJob job;
+        job.flags = x.flags;
+        std::ostringstream defineBlock;
+        for(auto& s: x.strings) {
+            defineBlock << "#define " << s << "\n";
+        }
+        job.defines = defineBlock.str();
+        target.jobs.push_back(job);
+    }
+    return 1;
+}
+
+static std::string DepfileEscape(const std::string& path)
+{
+    std::string out;
+    for(char c : path) {
+        if(c == ' ' || c == '#' || c == '\\') out += '\\';
+        else if(c == '$') out += '$';
+        out += c;
+    }
+    return out;
+}
+
+/* Make/Ninja dependency file: "outputs: inputs includes..." */
+static int WriteDepfile(const std::string& path, const std::vector<const ShaderTarget*>& targets, const char *featureList)
+{
+    FILE *out = fopen(path.c_str(), "w");
+    if(!out) {
+        fprintf(stderr, "could not open file for writing %s\n", path.c_str());
+        return 0;
+    }
+    for(size_t i = 0; i < targets.size(); i++)
+        fprintf(out, "%s%s", i ? " " : "", DepfileEscape(targets[i]->output).c_str());
+    fprintf(out, ":");
+    std::vector<std::string> written;
+    for(auto t : targets) {
+        for(auto& d : t->shader->dependencies) {
+            if(std::find(written.begin(), written.end(), d) != written.end()) continue;
+            written.push_back(d);
+            fprintf(out, " \\\n  %s", DepfileEscape(d).c_str());
+        }
+    }
+    if(featureList)
+        fprintf(out, " \\\n  %s", DepfileEscape(featureList).c_str());
+    fprintf(out, "\n");
+    fclose(out);
+    return 1;
+}
+
+/* Manifest: one "input output" pair per line, # starts a comment */
+static int ReadManifest(const char *path, std::vector<std::pair<std::string, std::string>>& pairs)
+{
+    std::istringstream manifest(ReadAllText(path));
+    std::string nextLine;
+    int lineNo = 0;
+    while(std::getline(manifest, nextLine)) {
+        lineNo++;
+        std::vector<std::string> words = SplitWords(nextLine);
+        if(!words.size() || words[0][0] == '#') continue;
+        if(words.size() != 2) {
+            fprintf(stderr, "%s:%d: expected `input output`\n", path, lineNo);
+            return 0;
+        }
+        pairs.push_back(std::make_pair(words[0], words[1]));
+    }
+    return 1;
+}
+
+/* Version 3 layout, all integers little endian uint32:
+ *   magic 0xABCDABD0, string count, shader count
+ *   strings: (file offset, compressed size, size) per unique stage source
+ *   shaders: (caps, vertex string, fragment string, reflection string)
+ *   independently zlib-compressed source blobs
+ * Most features only change one stage, so identical sources are stored once.
+ * The index is uncompressed so loaders can inflate only what they use. */
+static int WriteShaderFile(const char *path, std::vector<CompiledShader>& compiled, int verbose)
+{
+    std::vector<const std::string*> strings;
+    std::unordered_map<std::string, int> stringIndices;
+    auto intern = [&](const std::string& str) {
+        auto it = stringIndices.find(str);
+        if(it != stringIndices.end()) return it->second;
+        int idx = (int)strings.size();
+        stringIndices[str] = idx;
+        strings.push_back(&str);
+        return idx;
+    };
+    std::vector<uint32_t> header;
+    header.push_back(0xABCDABD0);
+    header.push_back(0); //string count
+    header.push_back(compiled.size());
+    std::vector<uint32_t> entries;
+    for(auto &x : compiled) {
+        entries.push_back(x.flags);
+        entries.push_back(intern(x.vertex));
+        entries.push_back(intern(x.fragment));
+        entries.push_back(intern(x.reflection));
+    }
+    header[1] = strings.size();
+
+    std::vector<std::vector<unsigned char>> blobs;
+    uint32_t offset = (header.size() + strings.size() * 3 + entries.size()) * sizeof(uint32_t);
+    size_t totalSize = 0;
+    for(auto x : strings) {
+        mz_ulong compSize = compressBound(x->size());
+        std::vector<unsigned char> blob(compSize);
+        if(compress(blob.data(), &compSize, (const unsigned char*)x->c_str(), x->size()) != Z_OK) {
+            fprintf(stderr, "compress() failed!\n");
+            return 0;
+        }
+        blob.resize(compSize);
+        header.push_back(offset);
+        header.push_back(compSize);
+        header.push_back(x->size());
+        offset += compSize;
+        totalSize += x->size();
+        blobs.push_back(std::move(blob));
+    }
+    if(verbose) {
+        fprintf(stderr, "%d unique stage sources for %d shaders, %d bytes (%d compressed)\n",
+            (int)strings.size(), (int)compiled.size(), (int)totalSize, (int)offset);
+    }
+
+    FILE *out = fopen(path, "wb");
+    if(!out) {
+        fprintf(stderr, "could not open file for writing %s", path);
+        return 0;
+    }
+    fwrite(header.data(), sizeof(uint32_t), header.size(), out);
+    fwrite(entries.data(), sizeof(uint32_t), entries.size(), out);
+    for(auto &b : blobs) {
+        fwrite(b.data(), 1, b.size(), out);
+    }
+    fclose(out);
+    return 1;
+}
+
 int CompilerMain(int argc, char **argv)
 {
-    char *arg1 = NULL;
-    char *arg2 = NULL;
+    std::vector<char*> positional;
     char *featureList = NULL;
+    char *cacheDir = NULL;
+    char *manifest = NULL;
+    int cacheStats = 0;
+    int depfiles = 0;
+    char *combinedDepfile = NULL;
 
     int processingArgs = 1;
     int showHelp = 0;
     int verbose = 0;
     int dump = 0;
+    int threads = (int)std::thread::hardware_concurrency();
+    if(threads < 1) threads = 1;
     for(int i = 1; i < argc; i++) {
         if(processingArgs && argv[i][0] == '-') {
             if(argv[i][1] == '-') {
@@ -167,6 +622,50 @@ int CompilerMain(int argc, char **argv)
                     featureList = argv[++i];
                     continue;
                 }
+                if(!strcmp(argv[i], "--cache")) {
+                    if(argc <= (i + 1)) {
+                        fprintf(stderr, "option --cache requires argument\n");
+                        return 1;
+                    }
+                    cacheDir = argv[++i];
+                    continue;
+                }
+                if(!strcmp(argv[i], "--cache-stats")) {
+                    cacheStats = 1;
+                    continue;
+                }
+                if(!strcmp(argv[i], "--jobs")) {
+                    if(argc <= (i + 1)) {
+                        fprintf(stderr, "option --jobs requires argument\n");
+                        return 1;
+                    }
+                    threads = atoi(argv[++i]);
+                    continue;
+                }
+                if(!strcmp(argv[i], "--manifest")) {
+                    if(argc <= (i + 1)) {
+                        fprintf(stderr, "option --manifest requires argument\n");
+                        return 1;
+                    }
+                    manifest = argv[++i];
+                    continue;
+                }
+                if(!strcmp(argv[i], "--minify")) {
+                    minifyOutput = true;
+                    continue;
+                }
+                if(!strcmp(argv[i], "--depfile")) {
+                    depfiles = 1;
+                    continue;
+                }
+                if(!strcmp(argv[i], "--depfile-all")) {
+                    if(argc <= (i + 1)) {
+                        fprintf(stderr, "option --depfile-all requires argument\n");
+                        return 1;
+                    }
+                    combinedDepfile = argv[++i];
+                    continue;
+                }
             } else {
                 switch(argv[i][1]) {
                     case '\0': //-
@@ -188,6 +687,23 @@ int CompilerMain(int argc, char **argv)
                         }
                         featureList = argv[++i];
                         continue;
+                    case 'j':
+                        if(argc <= (i + 1)) {
+                            fprintf(stderr, "option -j requires argument\n");
+                            return 1;
+                        }
+                        threads = atoi(argv[++i]);
+                        continue;
+                    case 'm':
+                        if(argc <= (i + 1)) {
+                            fprintf(stderr, "option -m requires argument\n");
+                            return 1;
+                        }
+                        manifest = argv[++i];
+                        continue;
+                    case 'M':
+                        depfiles = 1;
+                        continue;
                 }
             }
             if(!strcmp(argv[i], "--")) {
@@ -198,235 +714,142 @@ int CompilerMain(int argc, char **argv)
             return 1;
         }
         setarg:
-        if(arg2) continue;
-        if(arg1) { arg2 = argv[i]; }
-        else arg1 = argv[i];
+        positional.push_back(argv[i]);
     }
 
     if(showHelp) {
         printf("lrshadertool\n");
-        printf("Usage %s shader output\n", argv[0]);
+        printf("Usage %s shader output [shader output ...]\n", argv[0]);
         printf("validates shader file and compiles all possible feature combinations.\n");
         printf("OPTIONS:\n");
         printf("-h|--help:\t\t\t\tShows this message\n");
         printf("-f|--feature-list [file]:\t\tspecify file containing list of features for bitfield use\n");
+        printf("-m|--manifest [file]:\t\t\tcompile each `shader output` pair listed in file\n");
+        printf("-M|--depfile:\t\t\t\twrite a Make/Ninja dependency file output.d for each output\n");
+        printf("--depfile-all [file]:\t\t\twrite one dependency file covering every output\n");
+        printf("--minify:\t\t\t\tstrip unused declarations, comments and whitespace and shorten internal names\n");
+        printf("--cache [dir]:\t\t\t\treuse GLSL compiled by previous runs, stored in dir\n");
+        printf("--cache-stats:\t\t\t\tprint cache hit/miss counts\n");
+        printf("-j|--jobs [n]:\t\t\t\tcompile permutations on n threads (default: hardware concurrency)\n");
         return 0;
     }
 
-    if(!arg1 || !arg2) {
-        printf("Usage %s [options] shader output\n", argv[0]);
-        printf("Try %s --help for more info.\n", argv[0]);
-        return 0;
+    std::vector<std::pair<std::string, std::string>> pairs;
+    if(manifest) {
+        if(access(manifest, F_OK) != 0) {
+            fprintf(stderr, "Manifest file `%s` does not exist.\n", manifest);
+            return 2;
+        }
+        if(!ReadManifest(manifest, pairs)) return 1;
     }
-    if(!strcmp(arg1, "-")) {
-        fprintf(stderr, "Cannot read shader input from stdin.\n");
+    if(positional.size() & 1) {
+        fprintf(stderr, "Input `%s` has no output file.\n", positional.back());
         return 2;
     }
-    if(!strcmp(arg2, "-")) {
-        fprintf(stderr, "Cannot write shader output to stdout.\n");
-        return 2;
+    for(size_t i = 0; i < positional.size(); i += 2) {
+        pairs.push_back(std::make_pair(std::string(positional[i]), std::string(positional[i + 1])));
     }
-    if(access(arg1, F_OK) != 0 ) {
-        fprintf(stderr, "Input file `%s` does not exist.\n", arg1);
-        return 2;
+    if(!pairs.size()) {
+        printf("Usage %s [options] shader output\n", argv[0]);
+        printf("Try %s --help for more info.\n", argv[0]);
+        return 0;
+    }
+    for(auto& p : pairs) {
+        if(p.first == "-") {
+            fprintf(stderr, "Cannot read shader input from stdin.\n");
+            return 2;
+        }
+        if(p.second == "-") {
+            fprintf(stderr, "Cannot write shader output to stdout.\n");
+            return 2;
+        }
+        if(access(p.first.c_str(), F_OK) != 0 ) {
+            fprintf(stderr, "Input file `%s` does not exist.\n", p.first.c_str());
+            return 2;
+        }
     }
     if (featureList && access (featureList, F_OK) != 0) {
         fprintf(stderr, "FeatureList file '%s' does not exist.\n",featureList);
         return 2;
     }
 
-
-    ShFile shader(arg1);
-
-    std::string filename = GetFilename(arg1);
-    std::vector<uint32_t> spv;
-    std::string outGlsl;
-
-    std::vector<std::string> flStrings;
-    std::vector<int> flFlags;
-    std::vector<int> shFlags;
-
+    FeatureList fl;
     if(featureList) {
         if(verbose) {
             fprintf(stderr, "Using feature list for bitflags order.\n");
         }
-        std::istringstream flist(ReadAllText(featureList));
-        std::string nextLine;
-        while(std::getline(flist, nextLine)) {
-            for(int i = 0; i < nextLine.size(); i++) {
-                if(!isspace(nextLine[i]))
-                {
-                    flStrings.push_back(nextLine);
-                    break;
-                }
-            }
-        }
-        for(int i = 0; i < flStrings.size(); i++) {
-            flFlags.push_back(1 << i);
-        }
-        /* sort features */
-        for(int i = 0; i < shader.features.size(); i++) {
-            auto pos = std::find(flStrings.begin(), flStrings.end(), shader.features[i]);
-            if(pos == flStrings.end()) {
-                fprintf(stderr, "Feature `%s` in file `%s` was not present in feature list\n", shader.features[i].c_str(), arg1);
-                return 1;
-            }
-            int index = std::distance( flStrings.begin(), pos );
-            if(verbose) {
-                fprintf(stderr, "Feature `%s`: flag 0x%x\n", shader.features[i].c_str(), flFlags[index]);
-            }
-            shFlags.push_back(flFlags[index]);
-        }
-    } else {
-        for(int i = 0; i < shader.features.size(); i++) {
-            shFlags.push_back(1 << i);
-        }
-    }
-
-    //Compile
-    if(verbose) fprintf(stderr, "Compiling without flags\n");
-    std::vector<CompiledShader> compiled;
-    StringVectorVector permutations = Permute(shader.features, shFlags);
-    {
-        CompiledShader zero;
-        zero.flags = 0;
-        //sort vertex shader
-        if(!CompileShader(shader.vertex_source.c_str(), filename.c_str(), "", true, spv)) {
-            fprintf(stderr, "vertex shader compilation failed\n");
-            return 1;
-        }
-        if(!ToGLSL(spv, outGlsl)) {
-            fprintf(stderr, "vertex shader compilation failed\n");
-            return 1;
-        }
-        if(dump) {
-            std::cout << outGlsl << std::endl;
-        }
-        zero.vertex = outGlsl;
-        spv = std::vector<uint32_t>();
-        if(!CompileShader(shader.fragment_source.c_str(), filename.c_str(), "", false, spv)) {
-            fprintf(stderr, "fragment shader compilation failed\n");
-            return 1;
-        }
-        if(!ToGLSL(spv, outGlsl)) {
-            fprintf(stderr, "fragment shader compilation failed\n");
+        if(!ParseFeatureList(featureList, fl)) {
             return 1;
         }
-        if(dump) {
-            std::cout << outGlsl << std::endl;
-        }
-        zero.fragment = outGlsl;
-        compiled.push_back(zero);
     }
 
-    for(auto& x: permutations) {
-        //Print current flags
-        if(verbose) {
-            fprintf(stderr, "Compiling with 0x%x: ", x.flags);
-            int a = 0;
-            for(auto& s: x.strings) {
-                if(a) fprintf(stderr, ", ");
-                a = 1;
-                fprintf(stderr, "%s", s.c_str());
-            }
-            fprintf(stderr, "\n");
-        }
-        //Compiling
-        CompiledShader sh;
-        sh.flags = x.flags;
-        std::ostringstream defineBlock;
-        for(auto& s: x.strings) {
-            defineBlock << "#define " << s << "\n";
-        }
-        std::string defs = defineBlock.str();
-        const char *chars_def = defs.c_str();
-        spv = std::vector<uint32_t>();
-        if(!CompileShader(shader.vertex_source.c_str(), filename.c_str(), chars_def, true, spv)) {
-            fprintf(stderr, "vertex shader compilation failed\n using %s\n", chars_def);
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<ShaderTarget> targets(pairs.size());
+    int totalJobs = 0;
+    double preprocessTime = 0;
+    for(size_t i = 0; i < pairs.size(); i++) {
+        ShaderTarget& t = targets[i];
+        t.input = pairs[i].first;
+        t.output = pairs[i].second;
+        t.filename = GetFilename(t.input);
+        auto preprocessStart = std::chrono::steady_clock::now();
+        try {
+            t.shader.reset(new ShFile(t.input.c_str()));
+        } catch(const std::exception& e) {
+            fprintf(stderr, "%s: %s\n", t.input.c_str(), e.what());
             return 1;
         }
-        if(!ToGLSL(spv, outGlsl)) {
-            fprintf(stderr, "vertex shader compilation failed\nusing %s\n", chars_def);
-            return 1;
-        }
-        spv = std::vector<uint32_t>();
-        sh.vertex = outGlsl;
-         if(!CompileShader(shader.fragment_source.c_str(), filename.c_str(), chars_def, false, spv)) {
-            fprintf(stderr, "fragment shader compilation failed\nusing %s\n", chars_def);
-            return 1;
+        std::chrono::duration<double> preprocessed = std::chrono::steady_clock::now() - preprocessStart;
+        preprocessTime += preprocessed.count();
+        if(verbose) {
+            fprintf(stderr, "%s: preprocessed in %.3fms, %d dependencies\n", t.filename.c_str(),
+                preprocessed.count() * 1000.0, (int)t.shader->dependencies.size());
         }
-        if(!ToGLSL(spv, outGlsl)) {
-            fprintf(stderr, "fragment shader compilation failed\nusing %s\n", chars_def);
+        if(!BuildJobs(t, featureList ? &fl : NULL, verbose))
             return 1;
-        }
-        sh.fragment = outGlsl;
-        compiled.push_back(sh);
-    }
-    //Write to file
-    /*std::ofstream outfile(arg2);
-    for (auto &x : compiled) {
-        outfile << "++flags: " << x.flags << "\n";
-        outfile << "== VERTEX ==\n";
-        outfile << x.vertex << "\n";
-        outfile << "== FRAGMENT ==\n";
-        outfile << x.fragment << "\n";
-    }*/
-
-    int size = sizeof(uint32_t);
-    for(auto &x : compiled) {
-        size += sizeof(uint32_t); //flags
-        size += sizeof(uint32_t); //vertLength
-        size += x.vertex.size(); //vertSize (plus trailing zero)
-        size += sizeof(uint32_t); //fragLength
-        size += x.fragment.size(); //fragSize (plus trailing zero)
+        totalJobs += (int)t.jobs.size();
     }
 
-    unsigned char *data = (unsigned char*)malloc(size);
-    unsigned char *dptr = data;
-
-    #define WRITE_INT(x) do { \
-        *(uint32_t*)(dptr) = (uint32_t)(x);\
-        dptr += 4;\
-    } while(0)
-    WRITE_INT(compiled.size());
-    for(auto &x : compiled) {
-        WRITE_INT(x.flags);
-        WRITE_INT(x.vertex.size());
-        memcpy((void*)dptr, x.vertex.c_str(), x.vertex.size());
-        dptr += x.vertex.size();
-        WRITE_INT(x.fragment.size());
-        memcpy((void*)dptr, x.fragment.c_str(), x.fragment.size());
-        dptr += x.fragment.size();
-    }
-
-    unsigned char *comp = (unsigned char*)malloc(compressBound(size));
-    mz_ulong compSize = compressBound(size);
-    int cmp_status = compress(comp, &compSize, data, size);
-    free(data);
-    if (cmp_status != Z_OK)
-    {
-        fprintf(stderr, "compress() failed!\n");
-        return 1;
+    if(verbose) {
+        fprintf(stderr, "Preprocessed %d files in %.3fs\n", (int)targets.size(), preprocessTime);
     }
 
-    FILE *out = fopen(arg2, "wb");
-    if(!out) {
-        fprintf(stderr, "could not open file for writing %s", arg2);
+    std::unique_ptr<ShaderCache> cache;
+    if(cacheDir) cache.reset(new ShaderCache(cacheDir));
+    if(!CompileAll(targets, threads, cache.get())) {
         return 1;
     }
-    uint32_t sz_dat = (uint32_t)compSize;
-    uint32_t magic = 0xABCDABCD;
-    fwrite(&magic, 4, 1, out);
-    fwrite(&sz_dat, 4, 1, out);
-    fwrite(&size, 4, 1, out);
-    fwrite(comp, compSize, 1, out);
-    fclose(out);
+    if(cache && cacheStats) {
+        cache->PrintStats(stderr);
+    }
+    if(verbose) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+        fprintf(stderr, "Compiled %d permutations of %d files in %.3fs (%d threads)\n",
+            totalJobs, (int)targets.size(), elapsed.count(), threads);
+    }
+    if(minifyOutput && minifyBytesIn) {
+        long long in = minifyBytesIn, out = minifyBytesOut;
+        fprintf(stderr, "minify: %lld bytes of GLSL reduced to %lld (%.1f%%)\n", in, out, in ? (100.0 * out / in) : 100.0);
+    }
+    if(dump) {
+        std::cout << targets[0].compiled[0].vertex << std::endl;
+        std::cout << targets[0].compiled[0].fragment << std::endl;
+    }
+    for(auto& t : targets) {
+        if(!WriteShaderFile(t.output.c_str(), t.compiled, verbose))
+            return 1;
+        if(depfiles && !WriteDepfile(t.output + ".d", { &t }, featureList))
+            return 1;
+    }
+    if(combinedDepfile) {
+        std::vector<const ShaderTarget*> all;
+        for(auto& t : targets) all.push_back(&t);
+        if(!WriteDepfile(combinedDepfile, all, featureList))
+            return 1;
+    }
     return 0;
 }
 
-
-
-
 int main(int argc, char **argv)
 {
     int retval = 0;
@@ -443,4 +866,3 @@ int main(int argc, char **argv)
     GlslDestroy();
     return retval;
 }
-
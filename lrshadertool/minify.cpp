@@ -0,0 +1,313 @@
+#include "minify.h"
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <string.h>
+
+#define TOKEN_IDENT (0)
+#define TOKEN_NUMBER (1)
+#define TOKEN_PUNCT (2)
+#define TOKEN_DIRECTIVE (3)
+
+struct Token {
+    int type;
+    std::string text;
+};
+
+static const char *glslTypes[] = {
+    "void", "bool", "int", "uint", "float", "double",
+    "vec2", "vec3", "vec4", "ivec2", "ivec3", "ivec4",
+    "uvec2", "uvec3", "uvec4", "bvec2", "bvec3", "bvec4",
+    "dvec2", "dvec3", "dvec4",
+    "mat2", "mat3", "mat4", "mat2x2", "mat2x3", "mat2x4",
+    "mat3x2", "mat3x3", "mat3x4", "mat4x2", "mat4x3", "mat4x4",
+    "sampler1D", "sampler2D", "sampler3D", "samplerCube", "sampler2DRect",
+    "sampler1DArray", "sampler2DArray", "samplerBuffer", "sampler2DMS", "sampler2DMSArray",
+    "sampler1DShadow", "sampler2DShadow", "samplerCubeShadow", "sampler2DRectShadow",
+    "sampler1DArrayShadow", "sampler2DArrayShadow",
+    "isampler1D", "isampler2D", "isampler3D", "isamplerCube", "isampler2DRect",
+    "isampler1DArray", "isampler2DArray", "isamplerBuffer", "isampler2DMS", "isampler2DMSArray",
+    "usampler1D", "usampler2D", "usampler3D", "usamplerCube", "usampler2DRect",
+    "usampler1DArray", "usampler2DArray", "usamplerBuffer", "usampler2DMS", "usampler2DMSArray",
+};
+
+/* a global declaration containing one of these is part of the interface */
+static const char *interfaceQualifiers[] = {
+    "in", "out", "inout", "uniform", "attribute", "varying", "buffer", "shared",
+};
+
+/* reserved words that must never be generated as a new name */
+static const char *keywords[] = {
+    "if", "else", "for", "do", "while", "switch", "case", "default", "break",
+    "continue", "return", "discard", "struct", "const", "true", "false",
+    "layout", "flat", "smooth", "noperspective", "centroid", "invariant",
+    "precise", "precision", "highp", "mediump", "lowp", "patch", "sample",
+    "in", "out", "inout", "uniform", "attribute", "varying", "buffer", "shared",
+    "asm", "class", "union", "enum", "typedef", "template", "this", "packed",
+    "goto", "inline", "noinline", "volatile", "public", "static", "extern",
+    "external", "interface", "long", "short", "half", "fixed", "unsigned",
+    "superp", "input", "output", "hvec2", "hvec3", "hvec4", "fvec2", "fvec3",
+    "fvec4", "sizeof", "cast", "namespace", "using", "common", "partition",
+    "active", "filter", "image1D", "image2D", "image3D", "imageCube",
+    "subroutine", "coherent", "restrict", "readonly", "writeonly", "resource",
+};
+
+static inline bool IsIdentStart(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool IsIdentChar(char c)
+{
+    return IsIdentStart(c) || (c >= '0' && c <= '9');
+}
+
+static inline bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool InList(const char **list, size_t count, const std::string& s)
+{
+    for(size_t i = 0; i < count; i++) {
+        if(s == list[i]) return true;
+    }
+    return false;
+}
+
+#define IN_LIST(list, s) InList(list, sizeof(list) / sizeof(const char*), s)
+
+/* multi-character operators, longest first */
+static const char *operators[] = {
+    "<<=", ">>=",
+    "++", "--", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "==", "!=",
+    "<=", ">=", "<<", ">>", "&&", "||", "^^",
+};
+
+/* joining two separate tokens must not form an operator or a comment */
+static bool JoinsOperator(char a, char b)
+{
+    if(a == '/' && (b == '/' || b == '*')) return true;
+    for(size_t i = 0; i < sizeof(operators) / sizeof(const char*); i++) {
+        if(operators[i][0] == a && operators[i][1] == b) return true;
+    }
+    return false;
+}
+
+static void Tokenize(const std::string& src, std::vector<Token>& tokens)
+{
+    size_t i = 0;
+    size_t n = src.size();
+    bool lineStart = true;
+    while(i < n) {
+        char c = src[i];
+        if(c == '\n') {
+            lineStart = true;
+            i++;
+            continue;
+        }
+        if(c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+            i++;
+            continue;
+        }
+        if(c == '/' && i + 1 < n && src[i + 1] == '/') {
+            while(i < n && src[i] != '\n') i++;
+            continue;
+        }
+        if(c == '/' && i + 1 < n && src[i + 1] == '*') {
+            size_t end = src.find("*/", i + 2);
+            i = end == std::string::npos ? n : end + 2;
+            continue;
+        }
+        Token t;
+        size_t start = i;
+        if(c == '#' && lineStart) {
+            /* whole line, including continuations */
+            while(i < n && src[i] != '\n') {
+                if(src[i] == '\\' && i + 1 < n && src[i + 1] == '\n') i++;
+                i++;
+            }
+            t.type = TOKEN_DIRECTIVE;
+            size_t end = i;
+            while(end > start && (src[end - 1] == ' ' || src[end - 1] == '\t' || src[end - 1] == '\r')) end--;
+            t.text = src.substr(start, end - start);
+        } else if(IsIdentStart(c)) {
+            while(i < n && IsIdentChar(src[i])) i++;
+            t.type = TOKEN_IDENT;
+            t.text = src.substr(start, i - start);
+        } else if(IsDigit(c) || (c == '.' && i + 1 < n && IsDigit(src[i + 1]))) {
+            bool hex = c == '0' && i + 1 < n && (src[i + 1] == 'x' || src[i + 1] == 'X');
+            while(i < n) {
+                char d = src[i];
+                if(IsIdentChar(d) || d == '.') {
+                    i++;
+                } else if((d == '+' || d == '-') && !hex && (src[i - 1] == 'e' || src[i - 1] == 'E')) {
+                    i++;
+                } else {
+                    break;
+                }
+            }
+            t.type = TOKEN_NUMBER;
+            t.text = src.substr(start, i - start);
+        } else {
+            size_t len = 1;
+            for(size_t j = 0; j < sizeof(operators) / sizeof(const char*); j++) {
+                size_t oplen = strlen(operators[j]);
+                if(src.compare(i, oplen, operators[j]) == 0) {
+                    len = oplen;
+                    break;
+                }
+            }
+            i += len;
+            t.type = TOKEN_PUNCT;
+            t.text = src.substr(start, len);
+        }
+        lineStart = false;
+        tokens.push_back(t);
+    }
+}
+
+/* a, b, ... z, A ... Z, aa, ab ... skipping anything already in use */
+static std::string NextName(int& counter, const std::unordered_set<std::string>& used)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const int count = 52;
+    while(true) {
+        int v = counter++;
+        std::string name;
+        name += alphabet[v % count];
+        v /= count;
+        while(v > 0) {
+            v--;
+            name += alphabet[v % count];
+            v /= count;
+        }
+        if(used.find(name) == used.end() && !IN_LIST(keywords, name) && !IN_LIST(glslTypes, name))
+            return name;
+    }
+}
+
+std::string MinifyGLSL(const std::string& src)
+{
+    std::vector<Token> tokens;
+    Tokenize(src, tokens);
+
+    /* First pass: find declared names. A declaration is an identifier that
+     * directly follows a type (or `struct`). Members of blocks and structs
+     * and global interface variables are kept. */
+    std::unordered_set<std::string> used;
+    std::unordered_set<std::string> types;
+    std::unordered_set<std::string> declared;
+    std::unordered_set<std::string> keep;
+    keep.insert("main");
+    int braceDepth = 0;
+    int parenDepth = 0;
+    int aggregateDepth = 0; //brace depth of the struct/block being declared, 0 if none
+    bool interfaceStatement = false;
+    for(size_t i = 0; i < tokens.size(); i++) {
+        Token& t = tokens[i];
+        if(t.type == TOKEN_DIRECTIVE) {
+            /* anything a directive mentions stays as written */
+            std::vector<Token> inner;
+            Tokenize(t.text.substr(1), inner);
+            for(auto& x : inner) {
+                if(x.type == TOKEN_IDENT) {
+                    used.insert(x.text);
+                    keep.insert(x.text);
+                }
+            }
+            continue;
+        }
+        if(t.type == TOKEN_PUNCT) {
+            char c = t.text[0];
+            if(c == '(') parenDepth++;
+            else if(c == ')') parenDepth--;
+            else if(c == '{') {
+                /* structs and blocks are only declared at global scope */
+                bool functionBody = i > 0 && tokens[i - 1].text == ")";
+                if(!functionBody && braceDepth == 0) aggregateDepth = braceDepth + 1;
+                braceDepth++;
+                if(functionBody) interfaceStatement = false;
+            } else if(c == '}') {
+                if(aggregateDepth == braceDepth) aggregateDepth = 0;
+                braceDepth--;
+            } else if(c == ';' && braceDepth == 0) {
+                interfaceStatement = false;
+            }
+            continue;
+        }
+        if(t.type != TOKEN_IDENT) continue;
+        used.insert(t.text);
+        if(braceDepth == 0 && parenDepth == 0 && IN_LIST(interfaceQualifiers, t.text)) {
+            interfaceStatement = true;
+            continue;
+        }
+        if(i == 0) continue;
+        const Token& prev = tokens[i - 1];
+        if(prev.type != TOKEN_IDENT) continue;
+        if(t.text.compare(0, 3, "gl_") == 0) {
+            keep.insert(t.text);
+            continue;
+        }
+        bool isDeclaration = false;
+        if(prev.text == "struct") {
+            types.insert(t.text);
+            isDeclaration = true;
+        } else if(IN_LIST(glslTypes, prev.text) || types.count(prev.text)) {
+            isDeclaration = true;
+        }
+        if(!isDeclaration) continue;
+        if(aggregateDepth || (braceDepth == 0 && interfaceStatement))
+            keep.insert(t.text);
+        else
+            declared.insert(t.text);
+    }
+
+    std::unordered_map<std::string, std::string> names;
+    int counter = 0;
+    for(auto& t : tokens) {
+        /* first-use order keeps the output stable between runs */
+        if(t.type != TOKEN_IDENT) continue;
+        if(!declared.count(t.text) || keep.count(t.text) || names.count(t.text)) continue;
+        std::string name = NextName(counter, used);
+        if(name.size() >= t.text.size()) {
+            names[t.text] = t.text;
+            continue;
+        }
+        used.insert(name);
+        names[t.text] = name;
+    }
+
+    /* Second pass: print with only the whitespace the grammar needs */
+    std::string out;
+    out.reserve(src.size());
+    for(size_t i = 0; i < tokens.size(); i++) {
+        Token& t = tokens[i];
+        if(t.type == TOKEN_DIRECTIVE) {
+            if(out.size() && out.back() != '\n') out.push_back('\n');
+            out.append(t.text);
+            out.push_back('\n');
+            continue;
+        }
+        const std::string *text = &t.text;
+        bool member = i > 0 && tokens[i - 1].text == ".";
+        if(t.type == TOKEN_IDENT && !member) {
+            auto it = names.find(t.text);
+            if(it != names.end()) text = &it->second;
+        }
+        if(out.size() && out.back() != '\n') {
+            char a = out.back();
+            char b = (*text)[0];
+            bool prevNumber = i > 0 && tokens[i - 1].type == TOKEN_NUMBER;
+            if((IsIdentChar(a) && IsIdentChar(b)) ||
+                (prevNumber && (IsIdentChar(b) || b == '.')) ||
+                (t.type == TOKEN_PUNCT && JoinsOperator(a, b)) ||
+                (t.type == TOKEN_NUMBER && b == '.' && a == '.')) {
+                out.push_back(' ');
+            }
+        }
+        out.append(*text);
+    }
+    out.push_back('\n');
+    return out;
+}
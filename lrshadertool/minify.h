@@ -0,0 +1,13 @@
+#ifndef _MINIFY_H_
+#define _MINIFY_H_
+
+#include <string>
+
+/* Strips comments and whitespace from GLSL and shortens the names of
+ * functions, locals, parameters and struct types declared in it.
+ * Interface names (in/out/uniform declarations, block and struct members)
+ * are kept so the runtime can still look them up. Preprocessor lines are
+ * passed through unchanged. */
+std::string MinifyGLSL(const std::string& src);
+
+#endif
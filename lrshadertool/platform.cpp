@@ -9,10 +9,16 @@
 #include <codecvt>
 #include <iostream>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #ifdef _WIN32
 #include <tchar.h>
 #include <io.h>
+#include <process.h>
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #endif
@@ -87,6 +93,33 @@ std::string ReadAllText(std::string path)
 	return result;
 }
 
+int MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	if (CreateDirectoryA(path.c_str(), NULL)) return 1;
+	return GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	if (mkdir(path.c_str(), 0755) == 0) return 1;
+	return errno == EEXIST;
+#endif
+}
+
+long long FileModifiedTime(const std::string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) return -1;
+	return (long long)st.st_mtime;
+}
+
+long ProcessId()
+{
+#ifdef _WIN32
+	return (long)_getpid();
+#else
+	return (long)getpid();
+#endif
+}
+
 #ifdef WIN32
 char* win32_realpath(const char* inpath, char* mustNull)
 {
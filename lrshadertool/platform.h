@@ -2,6 +2,12 @@
 #define _PLATFORM_H_
 #include <string>
 std::string ReadAllText(std::string path);
+/* creates the directory if it does not exist, returns 0 on failure */
+int MakeDirectory(const std::string& path);
+/* modification time in seconds, -1 if the file cannot be accessed */
+long long FileModifiedTime(const std::string& path);
+/* id of the running process */
+long ProcessId();
 
 #ifdef WIN32
 char* win32_realpath(const char* inpath, char* mustNull);
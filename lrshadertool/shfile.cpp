@@ -1,17 +1,17 @@
 #include "shfile.h"
 #include <string>
-#include <sstream>
-#include <regex>
+#include <string.h>
 #include "platform.h"
 #include <stdlib.h>
 #include <stdexcept>
-
-#define INC_REGEX "^\\s*@\\s*include\\s*\\(([^\\)]*)\\)\\s*"
+#include <unordered_map>
+#include <algorithm>
 
 std::string FullPath(std::string file)
 {
     char *ptr;
     ptr = realpath(file.c_str(), NULL);
+    if(!ptr) throw std::invalid_argument("could not find file " + file);
     std::string res = std::string(ptr);
     free(ptr);
     return res;
@@ -39,11 +39,6 @@ static bool StringEndsWith(const std::string& str, const std::string& suffix)
     return str.size() >= suffix.size() && 0 == str.compare(str.size()-suffix.size(), suffix.size(), suffix);
 }
 
-static bool StringContains(const std::string& s1, const std::string& s2)
-{
-    return s1.find(s2) != std::string::npos;
-}
-
 std::string PathCombine(std::string a, std::string b)
 {
     if(StringEndsWith(a, PATH_SEP) || StringStartsWith(b, PATH_SEP)) {
@@ -53,48 +48,150 @@ std::string PathCombine(std::string a, std::string b)
     }
 }
 
-static std::string ProcessIncludes(std::string fname, std::string src, std::string dir)
+/* Directives are found with a plain scan rather than a regex, every line
+ * of every file passes through here */
+static inline bool IsSpace(char c)
 {
-    std::istringstream f(src);
-    std::ostringstream out;
-    std::string line;    
-    std::smatch sm;
-    std::regex e (INC_REGEX, std::regex::ECMAScript);
-    bool inMultilineComment = false;
-    while (std::getline(f, line)) {
-        if(!inMultilineComment) {
-            size_t commentStart = line.find("/*");
-            if(commentStart != std::string::npos) {
-                if(line.find("*/", commentStart) == std::string::npos) {
-                    inMultilineComment = true;
-                    goto printline;
-                }
-            }
-            if(regex_match(line, sm, e)) {
-                if(sm.size() < 2) {
-                    throw std::invalid_argument("include matching in" + fname);
-                }
-                std::string filearg = sm[1].str();
-                std::string infile = PathCombine(dir, filearg);
-                std::string insrc = ReadAllText(infile);
-                std::string inc = ProcessIncludes(infile, insrc, GetDirectory(infile));
-                out << inc << std::endl;
-                continue;
-            }
-        } else {
-            if(StringContains(line, "*/")) inMultilineComment = false;
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/* Matches optional whitespace, '@', optional whitespace and name at the start
+ * of [p, end). Returns the character after name, or NULL */
+static const char *MatchDirective(const char *p, const char *end, const char *name)
+{
+    while(p < end && IsSpace(*p)) p++;
+    if(p == end || *p != '@') return NULL;
+    p++;
+    while(p < end && IsSpace(*p)) p++;
+    for(; *name; name++, p++) {
+        if(p == end || *p != *name) return NULL;
+    }
+    return p;
+}
+
+/* @include(file) with nothing else on the line */
+static bool MatchInclude(const char *p, const char *end, std::string& file)
+{
+    if(!(p = MatchDirective(p, end, "include"))) return false;
+    while(p < end && IsSpace(*p)) p++;
+    if(p == end || *p != '(') return false;
+    const char *start = ++p;
+    while(p < end && *p != ')') p++;
+    if(p == end) return false;
+    file.assign(start, p - start);
+    for(p++; p < end; p++) {
+        if(!IsSpace(*p)) return false;
+    }
+    return true;
+}
+
+/* offset of needle within [from, end) of src, or npos */
+static size_t FindInLine(const std::string& src, size_t from, size_t end, const char *needle)
+{
+    const char *base = src.data();
+    const char *found = std::search(base + from, base + end, needle, needle + strlen(needle));
+    return found == base + end ? std::string::npos : (size_t)(found - base);
+}
+
+/* Advances through src one line at a time, end excludes the newline.
+ * Returns false at the end of input. */
+static bool NextLine(const std::string& src, size_t& pos, size_t& start, size_t& end)
+{
+    if(pos >= src.size()) return false;
+    start = pos;
+    end = src.find('\n', pos);
+    if(end == std::string::npos) end = src.size();
+    pos = end + 1;
+    return true;
+}
+
+/* Tracks block comments the same way for both passes: a line opening a
+ * comment that does not close on it is never a directive */
+static bool SkipCommentLine(const std::string& src, size_t start, size_t end, bool& inMultilineComment)
+{
+    if(inMultilineComment) {
+        if(FindInLine(src, start, end, "*/") != std::string::npos) inMultilineComment = false;
+        return true;
+    }
+    size_t commentStart = FindInLine(src, start, end, "/*");
+    if(commentStart != std::string::npos) {
+        if(FindInLine(src, commentStart, end, "*/") == std::string::npos) {
+            inMultilineComment = true;
+            return true;
         }
-        printline:
-        out << line << std::endl;
     }
-    return out.str();
+    return false;
 }
 
-static std::string trimStart(std::string s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-        return !std::isspace(ch);
-    }));
-    return s;
+struct ExpandedInclude {
+    std::string text;
+    /* the include itself, then everything it pulls in */
+    std::vector<std::string> dependencies;
+    std::vector<long long> mtimes;
+};
+
+/* Includes expanded so far, keyed by canonical path. Shared by every ShFile
+ * in the process so batch builds only read and scan common includes once.
+ * An entry is reused while the file and all of its own includes keep the
+ * modification times they were expanded with.
+ * ShFiles are loaded from the main thread only. */
+static std::unordered_map<std::string, ExpandedInclude> includeCache;
+
+static void AddDependency(std::vector<std::string>& deps, const std::string& path)
+{
+    if(std::find(deps.begin(), deps.end(), path) == deps.end())
+        deps.push_back(path);
+}
+
+static bool CacheValid(const ExpandedInclude& inc)
+{
+    for(size_t i = 0; i < inc.dependencies.size(); i++) {
+        if(FileModifiedTime(inc.dependencies[i]) != inc.mtimes[i]) return false;
+    }
+    return true;
+}
+
+static std::string ProcessIncludes(const std::string& fname, const std::string& src, const std::string& dir, std::vector<std::string>& deps, int depth);
+
+static const ExpandedInclude& ExpandInclude(const std::string& infile, int depth)
+{
+    auto cached = includeCache.find(infile);
+    if(cached != includeCache.end() && CacheValid(cached->second))
+        return cached->second;
+    if(depth > 64) throw std::invalid_argument("includes nested too deeply at " + infile);
+    ExpandedInclude expanded;
+    long long mtime = FileModifiedTime(infile);
+    expanded.dependencies.push_back(infile);
+    expanded.text = ProcessIncludes(infile, ReadAllText(infile), GetDirectory(infile), expanded.dependencies, depth + 1);
+    expanded.mtimes.push_back(mtime);
+    for(size_t i = 1; i < expanded.dependencies.size(); i++)
+        expanded.mtimes.push_back(FileModifiedTime(expanded.dependencies[i]));
+    ExpandedInclude& slot = includeCache[infile];
+    slot = std::move(expanded);
+    return slot;
+}
+
+static std::string ProcessIncludes(const std::string& fname, const std::string& src, const std::string& dir, std::vector<std::string>& deps, int depth)
+{
+    std::string out;
+    out.reserve(src.size() + 1);
+    std::string filearg;
+    bool inMultilineComment = false;
+    size_t pos = 0, start, end;
+    while(NextLine(src, pos, start, end)) {
+        if(!SkipCommentLine(src, start, end, inMultilineComment) &&
+            MatchInclude(src.data() + start, src.data() + end, filearg)) {
+            std::string infile = FullPath(PathCombine(dir, filearg));
+            const ExpandedInclude& inc = ExpandInclude(infile, depth);
+            for(auto& d : inc.dependencies) AddDependency(deps, d);
+            out.append(inc.text);
+            out.push_back('\n');
+            continue;
+        }
+        out.append(src, start, end - start);
+        out.push_back('\n');
+    }
+    return out;
 }
 
 static std::string trimBoth(std::string s) {
@@ -114,67 +211,57 @@ static std::string trimBoth(std::string s) {
 
 ShFile::ShFile(const char *infile)
 {
-    std::string src = ReadAllText(infile);
     std::string path = FullPath(std::string(infile));
-    src = ProcessIncludes(FullPath(path), src, GetDirectory(path));
-    std::istringstream f(src);
-    std::ostringstream cblock;
-    std::string line;
+    std::string src = ReadAllText(path);
+    this->dependencies.push_back(path);
+    src = ProcessIncludes(path, src, GetDirectory(path), this->dependencies, 0);
+    std::string cblock;
     int inBlock = BLOCK_NONE;
     bool hasVertex = false;
     bool hasFragment = false;
     bool inMultilineComment = false;
+    size_t pos = 0, start, end;
 
-    while (std::getline(f, line)) {
-        if(!inMultilineComment) {
-            size_t commentStart = line.find("/*");
-            if(commentStart != std::string::npos) {
-                if(line.find("*/", commentStart) == std::string::npos) {
-                    inMultilineComment = true;
-                    goto printline;
-                }
-            }
+    auto finishBlock = [&]() {
+        if(inBlock == BLOCK_VERTEX) this->vertex_source = cblock;
+        if(inBlock == BLOCK_FRAGMENT) this->fragment_source = cblock;
+        cblock.clear();
+    };
+
+    while(NextLine(src, pos, start, end)) {
+        if(!SkipCommentLine(src, start, end, inMultilineComment)) {
             /*directive*/
-            std::string trimmed = trimStart(line);
-            if(StringStartsWith(trimmed, "@vertex")) {
-                if(inBlock) {
-                    if(inBlock == BLOCK_VERTEX) this->vertex_source = cblock.str();
-                    if(inBlock == BLOCK_FRAGMENT) this->fragment_source = cblock.str();
-                    cblock = std::ostringstream();
-                }
-                cblock << "#define VERTEX_SHADER\n";
-                cblock << "#line 1000\n";
+            const char *lstart = src.data() + start;
+            const char *lend = src.data() + end;
+            const char *rest;
+            if(MatchDirective(lstart, lend, "vertex")) {
+                finishBlock();
+                cblock.append("#define VERTEX_SHADER\n");
+                cblock.append("#line 1000\n");
                 inBlock = BLOCK_VERTEX;
                 hasVertex = true;
                 continue;
-            } else if (StringStartsWith(trimmed, "@fragment")) {
-                if(inBlock) {
-                    if(inBlock == BLOCK_VERTEX) this->vertex_source = cblock.str();
-                    if(inBlock == BLOCK_FRAGMENT) this->fragment_source = cblock.str();
-                    cblock = std::ostringstream();
-                }
-                cblock << "#define FRAGMENT_SHADER\n";
-                cblock << "#line 1000\n";
+            } else if (MatchDirective(lstart, lend, "fragment")) {
+                finishBlock();
+                cblock.append("#define FRAGMENT_SHADER\n");
+                cblock.append("#line 1000\n");
                 inBlock = BLOCK_FRAGMENT;
                 hasFragment = true;
                 continue;
-            } else if (StringStartsWith(trimmed, "@feature")) {
-                std::string nf = trimBoth(trimmed.substr(8));
+            } else if ((rest = MatchDirective(lstart, lend, "feature"))) {
+                std::string nf = trimBoth(std::string(rest, lend - rest));
                 if(nf != "") {
                     this->features.push_back(nf);
                 }
                 continue;
             }
-        } else {
-           if(StringContains(line, "*/")) inMultilineComment = false; 
         }
-        printline:
-        if(inBlock) cblock << line << std::endl;
-    }
-    if(inBlock) {
-        if(inBlock == BLOCK_VERTEX) this->vertex_source = cblock.str();
-        if(inBlock == BLOCK_FRAGMENT) this->fragment_source = cblock.str();
+        if(inBlock) {
+            cblock.append(src, start, end - start);
+            cblock.push_back('\n');
+        }
     }
+    finishBlock();
     if(!hasVertex) throw std::invalid_argument("shader file does not have vertex shader");
     if(!hasFragment) throw std::invalid_argument("shader file does not have fragment shader");
-}
\ No newline at end of file
+}
@@ -10,6 +10,8 @@ class ShFile {
         std::string vertex_source;
         std::string fragment_source;
         std::vector<std::string> features;
+        /* full paths of the input and every file it includes */
+        std::vector<std::string> dependencies;
 };
 
 #endif
\ No newline at end of file
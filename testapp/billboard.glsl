@@ -8,8 +8,11 @@ in vec2 vertex_texture1;
 out vec2 Vertex_UV;
 out vec4 Vertex_Color;
 
-uniform mat4 View;
-uniform mat4 ViewProjection;
+layout (std140) uniform Camera {
+    mat4 View;
+    mat4 Projection;
+    mat4 ViewProjection;
+};
 
 void main()
 {
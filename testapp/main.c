@@ -1,6 +1,7 @@
 #include <SDL.h>
 #include <lancerrender.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <cglm/cglm.h>  
 #include "stb_image.h"
@@ -106,7 +107,8 @@ LR_Geometry *geom;
 LR_VertexDeclaration *decl;
 
 int baseVertex;
-int startIndex;
+LR_LODSet *monkeyLods;
+float monkeySphere[4];
 
 typedef struct {
 	float lightEnabled; //vec4 1
@@ -232,6 +234,8 @@ static void Sample_Init()
     SDL_free(monkeyPath);
     LR_ShaderCollection_DefaultShadersFromFile(lrctx, sh, file);
     SDL_RWclose(file);
+    //LIGHTING is the first @feature in monkeyshader.glsl, unlit variant used without lights
+    LR_ShaderCollection_SetAutoCap(lrctx, sh, LRAUTOCAP_LIGHTING, 1 << 0);
 
     mat = LR_Material_Create(lrctx);
     LR_Material_SetShaders(lrctx, mat, sh); //shaders
@@ -252,10 +256,50 @@ static void Sample_Init()
         { .slot = LRELEMENTSLOT_NORMAL, .type = LRELEMENTTYPE_FLOAT, .elements = 3, .normalized = 0, .offset = 3 * sizeof(float) },
         { .slot = LRELEMENTSLOT_TEXTURE1, .type = LRELEMENTTYPE_FLOAT, .elements = 2, .normalized = 0, .offset = 6 * sizeof(float) }
     };
-    decl = LR_VertexDeclaration_Create(lrctx, 8 * sizeof(float), 3, elements);
+    LR_VertexDeclaration *floatDecl = LR_VertexDeclaration_Create(lrctx, 8 * sizeof(float), 3, elements);
+    //pack to 20 bytes: float position, 2_10_10_10 normal, half float uv
+    LR_VertexElement packed[] = {
+        { .slot = LRELEMENTSLOT_POSITION, .type = LRELEMENTTYPE_FLOAT, .elements = 3, .normalized = 0, .offset = 0 },
+        { .slot = LRELEMENTSLOT_NORMAL, .type = LRELEMENTTYPE_INT_2_10_10_10_REV, .elements = 4, .normalized = 1, .offset = 3 * sizeof(float) },
+        { .slot = LRELEMENTSLOT_TEXTURE1, .type = LRELEMENTTYPE_HALF_FLOAT, .elements = 2, .normalized = 0, .offset = 4 * sizeof(float) }
+    };
+    decl = LR_VertexDeclaration_Create(lrctx, 5 * sizeof(float), 3, packed);
+    void *packedVertices = malloc(suzanneVertexCount * 5 * sizeof(float));
+    LR_ConvertVertices(decl, packedVertices, floatDecl, suzanneVertices, suzanneVertexCount);
+    LR_VertexDeclaration_Free(lrctx, floatDecl);
+    LR_VertexCacheStats cacheStats;
+    LR_OptimizeVertexCache(suzanneIndices, LRINDEXTYPE_USHORT, suzanneIndexCount, suzanneVertexCount, &cacheStats);
+    LR_OptimizeVertexFetch(packedVertices, 5 * sizeof(float), suzanneVertexCount, suzanneIndices, LRINDEXTYPE_USHORT, suzanneIndexCount);
+    printf("Suzanne ACMR: %.3f -> %.3f\n", cacheStats.acmrBefore, cacheStats.acmrAfter);
     geom = LR_StaticGeometry_Create(lrctx, decl);
-    LR_StaticGeometry_UploadVertices(lrctx, geom, suzanneVertices, suzanneVertexCount, &baseVertex);
-    LR_StaticGeometry_UploadIndices(lrctx, geom, suzanneIndices, suzanneIndexCount, &startIndex);
+    LR_StaticGeometry_UploadVertices(lrctx, geom, packedVertices, suzanneVertexCount, &baseVertex);
+    //two simplified levels appended after the full index list
+    LR_LODLevel levels[3] = {
+        { .indexCount = suzanneIndexCount },
+        { .maxScreenSize = 250 },
+        { .maxScreenSize = 80 }
+    };
+    LR_StaticGeometry_UploadIndices(lrctx, geom, suzanneIndices, suzanneIndexCount, &levels[0].startIndex);
+    uint16_t *lodIndices = malloc(suzanneIndexCount * sizeof(uint16_t));
+    for(int i = 1; i < 3; i++) {
+        levels[i].indexCount = LR_SimplifyClustered(
+            packedVertices, 5 * sizeof(float), 0, suzanneVertexCount,
+            suzanneIndices, LRINDEXTYPE_USHORT, suzanneIndexCount,
+            suzanneIndexCount >> (i * 2), lodIndices
+        );
+        LR_StaticGeometry_UploadIndices(lrctx, geom, lodIndices, levels[i].indexCount, &levels[i].startIndex);
+        printf("Suzanne LOD %d: %d triangles\n", i, levels[i].indexCount / 3);
+    }
+    free(lodIndices);
+    free(packedVertices);
+    monkeyLods = LR_LODSet_Create(lrctx, geom, baseVertex, levels, 3);
+    //bounding sphere around the origin
+    monkeySphere[0] = monkeySphere[1] = monkeySphere[2] = monkeySphere[3] = 0;
+    for(int i = 0; i < suzanneVertexCount; i++) {
+        suzanneVertex *v = &suzanneVertices[i];
+        float r = sqrtf(v->x * v->x + v->y * v->y + v->z * v->z);
+        if(r > monkeySphere[3]) monkeySphere[3] = r;
+    }
 
 
     LR_ShaderCollection *sh2 = LR_ShaderCollection_Create(lrctx);
@@ -391,9 +435,9 @@ static void Sample_Loop()
         .count = 1
     };
     LR_Handle transform = LR_AllocTransform(lrctx, (LR_Matrix4x4*)world, (LR_Matrix4x4*)normal);
-    ltMonkey.lightEnabled = ltToggle ? 1.0 : 0.0;
-    LR_Handle lighting = LR_SetLights(lrctx, &ltMonkey, ltToggle ? sizeof(Lighting) : sizeof(float));
-    LR_Draw(lrctx, mat, geom, &monkeyBinding, transform, lighting, LRPRIMTYPE_TRIANGLELIST, 0, baseVertex, startIndex, suzanneIndexCount);
+    ltMonkey.lightEnabled = 1.0;
+    LR_Handle lighting = ltToggle ? LR_SetLights(lrctx, &ltMonkey, sizeof(Lighting)) : 0;
+    LR_DrawLOD(lrctx, mat, monkeyLods, &monkeyBinding, transform, lighting, 0, monkeySphere, 0);
 
     vec3 pos = { 3, 0, -2 };
     AddBillboard(pos, sin(t), LR_RGBA(0xFF,0xFF,0x00,0xBA));
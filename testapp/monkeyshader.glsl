@@ -1,3 +1,4 @@
+@feature LIGHTING
 @vertex
 in vec3 vertex_position;
 in vec3 vertex_normal;
@@ -7,12 +8,21 @@ out vec2 texcoord;
 out vec3 normal;
 out vec3 fragPos;
 
-uniform mat4x4 World;
-uniform mat4x4 Normal;
-uniform mat4x4 ViewProjection;
+layout (std140) uniform Transforms {
+	mat4x4 TransformData[256];
+};
+uniform int TransformIndex;
+
+layout (std140) uniform Camera {
+	mat4x4 View;
+	mat4x4 Projection;
+	mat4x4 ViewProjection;
+};
 
 void main()
 {
+	mat4x4 World = TransformData[TransformIndex];
+	mat4x4 Normal = TransformData[TransformIndex + 1];
 
 	vec4 pos = (ViewProjection * World) * vec4(vertex_position, 1.0);
 	fragPos = (World * vec4(vertex_position, 1.0)).xyz;
@@ -30,6 +40,7 @@ in vec3 fragPos;
 
 uniform sampler2D texsampler;
 
+#ifdef LIGHTING
 layout (std140) uniform Lighting {
 	float lightEnabled; //vec4 1
 	float ambientR;
@@ -42,6 +53,7 @@ layout (std140) uniform Lighting {
 	float lightY; //vec4 3
 	float lightZ;
 };
+#endif
 
 layout (std140) uniform Bubble {
 		float eee;
@@ -55,6 +67,7 @@ void main()
 	
 	vec3 litColor;
 
+#ifdef LIGHTING
 	if(lightEnabled > 0.0) {
 		vec3 lightPos = vec3(lightX, lightY, lightZ);
 		vec3 lightColor = vec3(lightR, lightG, lightB);
@@ -67,6 +80,9 @@ void main()
 	} else {
 		litColor = objColor.xyz;
 	}
+#else
+	litColor = objColor.xyz;
+#endif
 
 	out_color = vec4(litColor, objColor.a);
 }